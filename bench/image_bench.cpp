@@ -0,0 +1,509 @@
+// Native benchmark for the image core.
+//
+// Runs the decode / resize / rotate / encode stages and the full optimize()
+// pipeline over the files in an image directory and over a synthetic set, and
+// prints per-stage timings as JSON (ns/pixel, MB/s of pixel data, peak RSS).
+//
+//   make bench
+//   ./work/native/image_bench [--images DIR] [--iterations N] [--width PX]
+//                             [--sizes 0.3,2,12,24,50] [--channels 1,3,4]
+//                             [--threads N] [--no-synthetic]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "libImage.h"
+#include "pillow_resize.hpp"
+#include "simple_imgproc.h"
+#include "thread_pool.h"
+
+namespace {
+
+struct Options {
+    std::string imagesDir = "images";
+    int iterations = 3;
+    int width = 1536;
+    std::vector<double> sizes = {0.3, 2, 12, 24, 50};
+    std::vector<int> channels = {1, 3, 4};
+    bool synthetic = true;
+};
+
+struct StageResult {
+    std::string name;
+    double ms;            // Best of all iterations
+    double pixels;        // Pixels processed by the stage
+    double bytes;         // Pixel bytes processed by the stage
+    long peakRssKb;       // Peak RSS while the stage ran
+};
+
+struct CaseResult {
+    std::string name;
+    int width;
+    int height;
+    int channels;
+    size_t inputBytes;
+    std::vector<StageResult> stages;
+    long peakRssKb;
+};
+
+// Peak RSS is reset per stage on Linux (clear_refs 5 resets VmHWM); elsewhere
+// the process-wide maximum from getrusage is reported.
+void resetPeakRss()
+{
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    if (clearRefs) {
+        clearRefs << "5";
+    }
+}
+
+long peakRssKb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtol(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Per-pixel 90 degree rotation as simple_imgproc::rotate did before the
+// tiled kernels, kept as the baseline for the rotate stages
+void rotatePerPixel(const SimpleImage& src, SimpleImage& dst)
+{
+    const int channels = src.channels();
+    dst.create(src.cols(), src.rows(), channels, src.pixelFormat());
+    for (int i = 0; i < src.rows(); i++) {
+        const uint8_t* srcRow = src.ptr<uint8_t>(i);
+        for (int j = 0; j < src.cols(); j++) {
+            uint8_t* dstPixel = dst.ptr<uint8_t>(j) + (src.rows() - 1 - i) * channels;
+            for (int c = 0; c < channels; c++) {
+                dstPixel[c] = srcRow[j * channels + c];
+            }
+        }
+    }
+}
+
+double timeStage(int iterations, const std::function<void()>& fn)
+{
+    double best = 0;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (i == 0 || ms < best) {
+            best = ms;
+        }
+    }
+    return best;
+}
+
+StageResult runStage(const char* name, int iterations, double pixels, double bytes, const std::function<void()>& fn)
+{
+    resetPeakRss();
+    double ms = timeStage(iterations, fn);
+    return {name, ms, pixels, bytes, peakRssKb()};
+}
+
+std::vector<double> parseNumbers(const std::string& list)
+{
+    std::vector<double> values;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(std::atof(item.c_str()));
+        }
+    }
+    return values;
+}
+
+// Quality 80 output at the given width, other options at their defaults
+OptimizeTarget benchTarget(float width, const char* format)
+{
+    OptimizeTarget target;
+    target.width = width;
+    target.quality = 80;
+    target.format = format;
+    return target;
+}
+
+// Deterministic test pattern: gradients plus noise so codecs have real work to do
+SimpleImage makeSynthetic(int width, int height, int channels)
+{
+    SimpleImage image(height, width, channels);
+    uint32_t seed = 0x12345678u;
+    for (int y = 0; y < height; ++y) {
+        uint8_t* row = image.ptr<uint8_t>(y);
+        for (int x = 0; x < width; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            int noise = static_cast<int>(seed >> 28) - 8;
+            for (int c = 0; c < channels; ++c) {
+                int base = c == 3 ? 255 - (x * 64 / width) : ((x * (c + 1) + y * (3 - c)) * 255) / (width + height);
+                row[x * channels + c] = static_cast<uint8_t>(std::clamp(base + noise, 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+CaseResult runCase(const std::string& name, const std::vector<uint8_t>* encoded, const SimpleImage& pixels,
+                   const Options& options)
+{
+    CaseResult result;
+    result.name = name;
+    result.width = pixels.cols();
+    result.height = pixels.rows();
+    result.channels = pixels.channels();
+    result.inputBytes = encoded ? encoded->size() : 0;
+
+    const double srcPixels = static_cast<double>(pixels.cols()) * pixels.rows();
+    const double srcBytes = srcPixels * pixels.channels();
+
+    if (encoded) {
+        // EXIF orientation lookup done for every input (JPEG APP1 / PNG eXIf / WebP EXIF)
+        result.stages.push_back(runStage("orientation", options.iterations, srcPixels, srcBytes, [&] {
+            ImageProcessor::getOrientation(reinterpret_cast<const char*>(encoded->data()), encoded->size());
+        }));
+
+        result.stages.push_back(runStage("decode", options.iterations, srcPixels, srcBytes, [&] {
+            ImageProcessor processor(encoded->data(), encoded->size());
+        }));
+
+        // Decode with the target bounds, enabling JPEG shrink-on-load
+        result.stages.push_back(runStage("decode_target", options.iterations, srcPixels, srcBytes, [&] {
+            ImageProcessor processor(encoded->data(), encoded->size(), static_cast<float>(options.width), 0);
+        }));
+
+        // Whole optimize() pipeline (row-streaming for JPEG / PNG input), then the
+        // same pipeline kept in Y / Cb / Cr planes (RGB path for non-YCbCr input)
+        const OptimizeTarget jpegTarget = benchTarget(static_cast<float>(options.width), "jpeg");
+        const OptimizeTarget webpTarget = benchTarget(static_cast<float>(options.width), "webp");
+        OptimizeTarget jpegPlanarTarget = jpegTarget;
+        OptimizeTarget webpPlanarTarget = webpTarget;
+        jpegPlanarTarget.planarYuv = true;
+        webpPlanarTarget.planarYuv = true;
+        result.stages.push_back(runStage("optimize_jpeg", options.iterations, srcPixels, srcBytes, [&] {
+            OptimizedImage optimized;
+            optimizeImage(encoded->data(), encoded->size(), jpegTarget, optimized);
+        }));
+        result.stages.push_back(runStage("optimize_jpeg_planar", options.iterations, srcPixels, srcBytes, [&] {
+            OptimizedImage optimized;
+            optimizeImage(encoded->data(), encoded->size(), jpegPlanarTarget, optimized);
+        }));
+        result.stages.push_back(runStage("optimize_webp", options.iterations, srcPixels, srcBytes, [&] {
+            OptimizedImage optimized;
+            optimizeImage(encoded->data(), encoded->size(), webpTarget, optimized);
+        }));
+        result.stages.push_back(runStage("optimize_webp_planar", options.iterations, srcPixels, srcBytes, [&] {
+            OptimizedImage optimized;
+            optimizeImage(encoded->data(), encoded->size(), webpPlanarTarget, optimized);
+        }));
+
+        // Orientation-only JPEG output: DCT block transform against decode, orient
+        // and re-encode (orientation 5, the transpose, is exact at any size)
+        if (detectImageFormat(encoded->data(), encoded->size()) == ImageFormat::JPEG) {
+            result.stages.push_back(runStage("transform_jpeg", options.iterations, srcPixels, srcBytes, [&] {
+                transformJPEG(encoded->data(), encoded->size(), 5, false);
+            }));
+            result.stages.push_back(runStage("reencode_orient5", options.iterations, srcPixels, srcBytes, [&] {
+                ImageProcessor processor(encoded->data(), encoded->size());
+                SimpleImage oriented;
+                simple_imgproc::orient(processor.getImage(), oriented, 5);
+                encodeJPEG(oriented, 90);
+            }));
+
+            // Grid-size output from the EXIF thumbnail (same as optimize_160 without one)
+            const OptimizeTarget gridTarget = benchTarget(160, "jpeg");
+            OptimizeTarget thumbnailTarget = gridTarget;
+            thumbnailTarget.useThumbnail = true;
+            result.stages.push_back(runStage("optimize_160", options.iterations, srcPixels, srcBytes, [&] {
+                OptimizedImage optimized;
+                optimizeImage(encoded->data(), encoded->size(), gridTarget, optimized);
+            }));
+            result.stages.push_back(runStage("optimize_160_thumbnail", options.iterations, srcPixels, srcBytes, [&] {
+                OptimizedImage optimized;
+                optimizeImage(encoded->data(), encoded->size(), thumbnailTarget, optimized);
+            }));
+        }
+
+        // One decode for a responsive set (target width, 1/2, 1/4) with cascading
+        result.stages.push_back(runStage("optimize_many", options.iterations, srcPixels, srcBytes, [&] {
+            const float width = static_cast<float>(options.width);
+            std::vector<OptimizeTarget> targets = {benchTarget(width, "jpeg"), benchTarget(width / 2, "jpeg"),
+                                                   benchTarget(width / 4, "jpeg")};
+            std::vector<OptimizedImage> optimized;
+            optimizeImageMany(encoded->data(), encoded->size(), targets, 2, optimized);
+        }));
+    }
+
+    // Resize to the target width; images already below it are halved so the stage still runs
+    float targetWidth = std::min(static_cast<float>(options.width), pixels.cols() / 2.0f);
+    int outWidth, outHeight;
+    computeOutputSize(pixels.cols(), pixels.rows(), targetWidth, 0, outWidth, outHeight);
+    outWidth = std::max(outWidth, 1);
+    outHeight = std::max(outHeight, 1);
+
+    SimpleImage resized;
+    result.stages.push_back(runStage("resize", options.iterations, srcPixels, srcBytes, [&] {
+        resized = PillowResize::resize(pixels, SimpleSize(outWidth, outHeight));
+    }));
+
+    // Same resize with EXIF orientation 6 applied by the last pass
+    result.stages.push_back(runStage("resize_orient6", options.iterations, srcPixels, srcBytes, [&] {
+        PillowResize::resize(pixels, SimpleSize(outWidth, outHeight), PillowResize::FilterType::Lanczos, 0.0, 6);
+    }));
+
+    // Lanczos after a box reduction to at least twice the target (reducing_gap 2)
+    result.stages.push_back(runStage("resize_reducing_gap", options.iterations, srcPixels, srcBytes, [&] {
+        PillowResize::resize(pixels, SimpleSize(outWidth, outHeight), PillowResize::FilterType::Lanczos, 2.0);
+    }));
+
+    // Cheaper filters for bulk thumbnails, and the integer-ratio area path
+    result.stages.push_back(runStage("resize_bilinear", options.iterations, srcPixels, srcBytes, [&] {
+        PillowResize::resize(pixels, SimpleSize(outWidth, outHeight), PillowResize::FilterType::Bilinear);
+    }));
+    result.stages.push_back(runStage("resize_box", options.iterations, srcPixels, srcBytes, [&] {
+        PillowResize::resize(pixels, SimpleSize(outWidth, outHeight), PillowResize::FilterType::Box);
+    }));
+    if (pixels.cols() >= 4 && pixels.rows() >= 4) {
+        result.stages.push_back(runStage("reduce_box_4x", options.iterations, srcPixels, srcBytes, [&] {
+            PillowResize::reduceBox(pixels, 4, 4);
+        }));
+    }
+
+    // Tiled SIMD transpose against the per-pixel loop it replaced
+    result.stages.push_back(runStage("rotate", options.iterations, srcPixels, srcBytes, [&] {
+        SimpleImage rotated;
+        simple_imgproc::rotate(pixels, rotated, simple_imgproc::ROTATE_90_CLOCKWISE);
+    }));
+    result.stages.push_back(runStage("rotate_per_pixel", options.iterations, srcPixels, srcBytes, [&] {
+        SimpleImage rotated;
+        rotatePerPixel(pixels, rotated);
+    }));
+
+    // Swizzle kernels for the case's layout: RGBA -> RGB is the PNG decode conversion
+    if (pixels.channels() == 1 || pixels.channels() == 3 || pixels.channels() == 4) {
+        const simple_imgproc::ColorConversion conversion = pixels.channels() == 1 ? simple_imgproc::GRAY2RGB
+                                                           : pixels.channels() == 4 ? simple_imgproc::RGBA2RGB
+                                                                                    : simple_imgproc::RGB2BGR;
+        result.stages.push_back(runStage("convert", options.iterations, srcPixels, srcBytes, [&] {
+            SimpleImage converted;
+            simple_imgproc::cvtColor(pixels, converted, conversion);
+        }));
+    }
+    if (pixels.channels() == 4) {
+        SimpleImage premultiplied;
+        simple_imgproc::cvtColor(pixels, premultiplied, simple_imgproc::RGBA2mRGBA);
+        result.stages.push_back(runStage("premultiply", options.iterations, srcPixels, srcBytes, [&] {
+            SimpleImage converted;
+            simple_imgproc::cvtColor(pixels, converted, simple_imgproc::RGBA2mRGBA);
+        }));
+        result.stages.push_back(runStage("unpremultiply", options.iterations, srcPixels, srcBytes, [&] {
+            SimpleImage converted;
+            simple_imgproc::cvtColor(premultiplied, converted, simple_imgproc::mRGBA2RGBA);
+        }));
+        // JPEG output with a background color, and the opaque check after decoding
+        const uint8_t background[3] = {255, 255, 255};
+        result.stages.push_back(runStage("composite", options.iterations, srcPixels, srcBytes, [&] {
+            SimpleImage converted;
+            simple_imgproc::composite(premultiplied, converted, background);
+        }));
+        result.stages.push_back(runStage("opaque_scan", options.iterations, srcPixels, srcBytes, [&] {
+            simple_imgproc::isOpaque(pixels);
+        }));
+    }
+
+    // Encoders take the gray or 3-channel working format (WebP also RGBA)
+    if (resized.channels() == 1 || resized.channels() == 3) {
+        const double outPixels = static_cast<double>(resized.cols()) * resized.rows();
+        const double outBytes = outPixels * resized.channels();
+
+        result.stages.push_back(runStage("encode_jpeg", options.iterations, outPixels, outBytes, [&] {
+            encodeJPEG(resized, 80);
+        }));
+        result.stages.push_back(runStage("encode_webp", options.iterations, outPixels, outBytes, [&] {
+            encodeWEBP(resized, 80, false);
+        }));
+
+        // Encoder presets: fast for interactive uploads, max for offline batch
+        EncoderOptions fast;
+        EncoderOptions max;
+        parseEncoderPreset("fast", fast);
+        parseEncoderPreset("max", max);
+        result.stages.push_back(runStage("encode_jpeg_fast", options.iterations, outPixels, outBytes, [&] {
+            encodeJPEG(resized, 80, fast);
+        }));
+        result.stages.push_back(runStage("encode_jpeg_max", options.iterations, outPixels, outBytes, [&] {
+            encodeJPEG(resized, 80, max);
+        }));
+        result.stages.push_back(runStage("encode_webp_fast", options.iterations, outPixels, outBytes, [&] {
+            encodeWEBP(resized, 80, false, fast);
+        }));
+        result.stages.push_back(runStage("encode_webp_max", options.iterations, outPixels, outBytes, [&] {
+            encodeWEBP(resized, 80, false, max);
+        }));
+    } else if (resized.channels() == 4) {
+        // WebP keeps the alpha of RGBA output
+        const double outPixels = static_cast<double>(resized.cols()) * resized.rows();
+        result.stages.push_back(runStage("encode_webp", options.iterations, outPixels, outPixels * 4, [&] {
+            encodeWEBP(resized, 80, false);
+        }));
+    }
+
+    result.peakRssKb = 0;
+    for (const StageResult& stage : result.stages) {
+        result.peakRssKb = std::max(result.peakRssKb, stage.peakRssKb);
+    }
+    return result;
+}
+
+void printCase(const CaseResult& result, bool last)
+{
+    std::printf("    {\n");
+    std::printf("      \"name\": \"%s\",\n", result.name.c_str());
+    std::printf("      \"width\": %d,\n", result.width);
+    std::printf("      \"height\": %d,\n", result.height);
+    std::printf("      \"channels\": %d,\n", result.channels);
+    std::printf("      \"megapixels\": %.3f,\n", result.width * static_cast<double>(result.height) / 1e6);
+    std::printf("      \"input_bytes\": %zu,\n", result.inputBytes);
+    std::printf("      \"peak_rss_kb\": %ld,\n", result.peakRssKb);
+    std::printf("      \"stages\": {\n");
+    for (size_t i = 0; i < result.stages.size(); ++i) {
+        const StageResult& stage = result.stages[i];
+        double nsPerPixel = stage.pixels > 0 ? stage.ms * 1e6 / stage.pixels : 0;
+        double mbPerSec = stage.ms > 0 ? (stage.bytes / 1e6) / (stage.ms / 1e3) : 0;
+        std::printf("        \"%s\": { \"ms\": %.3f, \"ns_per_pixel\": %.3f, \"mb_per_s\": %.1f, \"peak_rss_kb\": %ld }%s\n",
+                    stage.name.c_str(), stage.ms, nsPerPixel, mbPerSec, stage.peakRssKb,
+                    i + 1 < result.stages.size() ? "," : "");
+    }
+    std::printf("      }\n");
+    std::printf("    }%s\n", last ? "" : ",");
+}
+
+bool readFile(const std::filesystem::path& path, std::vector<uint8_t>& data)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "--images" && value) {
+            options.imagesDir = value;
+            ++i;
+        } else if (arg == "--iterations" && value) {
+            options.iterations = std::max(1, std::atoi(value));
+            ++i;
+        } else if (arg == "--width" && value) {
+            options.width = std::max(1, std::atoi(value));
+            ++i;
+        } else if (arg == "--sizes" && value) {
+            options.sizes = parseNumbers(value);
+            ++i;
+        } else if (arg == "--channels" && value) {
+            options.channels.clear();
+            for (double c : parseNumbers(value)) {
+                options.channels.push_back(static_cast<int>(c));
+            }
+            ++i;
+        } else if (arg == "--threads" && value) {
+            thread_pool::setThreadCount(std::atoi(value));
+            ++i;
+        } else if (arg == "--no-synthetic") {
+            options.synthetic = false;
+        } else {
+            std::fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<CaseResult> results;
+
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(options.imagesDir, ec)) {
+        if (entry.is_regular_file()) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    for (const auto& path : files) {
+        std::vector<uint8_t> data;
+        if (!readFile(path, data) || detectImageFormat(data.data(), data.size()) == ImageFormat::UNKNOWN) {
+            continue;
+        }
+        ImageProcessor processor(data.data(), data.size());
+        if (!processor.isValid()) {
+            std::fprintf(stderr, "Failed to decode %s\n", path.string().c_str());
+            continue;
+        }
+        results.push_back(runCase(path.filename().string(), &data, processor.getImage(), options));
+    }
+
+    if (options.synthetic) {
+        for (double megapixels : options.sizes) {
+            // 4:3 frame like most camera output
+            int width = static_cast<int>(std::sqrt(megapixels * 1e6 * 4 / 3));
+            int height = static_cast<int>(width * 3 / 4);
+            for (int channels : options.channels) {
+                SimpleImage image = makeSynthetic(width, height, channels);
+                char name[64];
+                std::snprintf(name, sizeof(name), "synthetic_%gmp_%dch", megapixels, channels);
+
+                if (channels == 1 || channels == 3) {
+                    // Decode is measured on a JPEG of the synthetic frame (grayscale for 1 channel)
+                    EncodedBuffer encoded = encodeJPEG(image, 90);
+                    std::vector<uint8_t> jpeg(encoded.data(), encoded.data() + encoded.size());
+                    results.push_back(runCase(name, &jpeg, image, options));
+                } else {
+                    results.push_back(runCase(name, nullptr, image, options));
+                }
+            }
+        }
+    }
+
+    std::printf("{\n");
+    std::printf("  \"iterations\": %d,\n", options.iterations);
+    std::printf("  \"target_width\": %d,\n", options.width);
+    std::printf("  \"threads\": %d,\n", thread_pool::threadCount());
+    std::printf("  \"cases\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        printCase(results[i], i + 1 == results.size());
+    }
+    std::printf("  ],\n");
+    const PillowResize::CoeffCacheStats cache = PillowResize::coeffCacheStats();
+    std::printf("  \"coeff_cache\": { \"hits\": %llu, \"misses\": %llu, \"entries\": %zu, \"bytes\": %zu }\n",
+                static_cast<unsigned long long>(cache.hits), static_cast<unsigned long long>(cache.misses),
+                cache.entries, cache.bytes);
+    std::printf("}\n");
+    return 0;
+}
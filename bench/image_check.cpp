@@ -0,0 +1,478 @@
+// Native equivalence checks for the image core.
+//
+// Compares the fixed-point resampler against the double-coefficient
+// resampler it replaced, and the row kernels of simple_imgproc against their
+// per-pixel definitions. Prints one line per check group and exits non-zero
+// when any group fails. The wasm SIMD kernels only exist in a -msimd128
+// build, so `make check-wasm` runs the same checks under node.
+//
+//   make check
+//   ./work/native/image_check [--verbose]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pillow_resize.hpp"
+#include "simple_image.h"
+#include "simple_imgproc.h"
+
+namespace {
+
+bool verbose = false;
+
+struct CheckResult {
+    const char* name;
+    long cases = 0;
+    long failures = 0;
+
+    // Records one case; the first few failures are printed with their details
+    template<typename... Args>
+    void expect(bool ok, const char* format, Args... args)
+    {
+        ++cases;
+        if (ok) {
+            return;
+        }
+        if (++failures <= 10 || verbose) {
+            std::printf("  %s: ", name);
+            std::printf(format, args...);
+            std::printf("\n");
+        }
+    }
+};
+
+uint32_t nextRandom(uint32_t& seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+}
+
+// Gradients with noise and hard edges, so rounding and clipping both matter
+SimpleImage makePattern(int width, int height, int channels, uint32_t seed)
+{
+    SimpleImage image(height, width, channels);
+    for (int y = 0; y < height; ++y) {
+        uint8_t* row = image.ptr<uint8_t>(y);
+        for (int x = 0; x < width; ++x) {
+            const bool edge = ((x / 3) + (y / 5)) % 4 == 0;
+            for (int c = 0; c < channels; ++c) {
+                const int base = edge ? (c & 1 ? 255 : 0) : (x * 7 + y * 3 + c * 50) & 255;
+                row[x * channels + c] = static_cast<uint8_t>(std::clamp(base + int(nextRandom(seed) % 9) - 4, 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+// ---------------------------------------------------------------------------
+// Resampler: int16 fixed point against the double-coefficient path
+
+// The resampler before the int16 coefficients: taps normalized in double
+// precision, rounded to 22 fraction bits and accumulated without int16
+// saturation (exact in double, int64 here)
+constexpr int32_t reference_precision = 32 - 8 - 2;
+
+struct ReferenceCoeffs {
+    int32_t ksize = 0;
+    std::vector<int32_t> bounds;
+    std::vector<int64_t> kk;
+};
+
+ReferenceCoeffs referenceCoeffs(int32_t in_size, int32_t out_size, const PillowResize::Filter& filter)
+{
+    ReferenceCoeffs coeffs;
+    const double scale = static_cast<double>(in_size) / out_size;
+    const double filterscale = std::max(scale, 1.0);
+    const double support = filter.support() * filterscale;
+    coeffs.ksize = static_cast<int32_t>(std::ceil(support)) * 2 + 1;
+    coeffs.kk.assign(static_cast<size_t>(out_size) * coeffs.ksize, 0);
+    coeffs.bounds.resize(out_size * 2);
+
+    std::vector<double> k(coeffs.ksize);
+    for (int32_t xx = 0; xx < out_size; ++xx) {
+        const double center = (xx + 0.5) * scale;
+        const int32_t xmin = std::max(static_cast<int32_t>(center - support + 0.5), 0);
+        const int32_t xmax = std::min(static_cast<int32_t>(center + support + 0.5), in_size) - xmin;
+        double ww = 0.0;
+        for (int32_t x = 0; x < xmax; ++x) {
+            k[x] = filter.filter((x + xmin - center + 0.5) / filterscale);
+            ww += k[x];
+        }
+        for (int32_t x = 0; x < xmax; ++x) {
+            const double w = (ww != 0.0 ? k[x] / ww : k[x]) * (1 << reference_precision);
+            coeffs.kk[xx * coeffs.ksize + x] = static_cast<int64_t>(std::trunc(w < 0 ? w - 0.5 : w + 0.5));
+        }
+        coeffs.bounds[xx * 2 + 0] = xmin;
+        coeffs.bounds[xx * 2 + 1] = xmax;
+    }
+    return coeffs;
+}
+
+uint8_t referenceClip(int64_t sum)
+{
+    return static_cast<uint8_t>(std::clamp<int64_t>(sum >> reference_precision, 0, 255));
+}
+
+SimpleImage referenceHorizontal(const SimpleImage& src, int out_width, const PillowResize::Filter& filter)
+{
+    const int channels = src.channels();
+    const ReferenceCoeffs coeffs = referenceCoeffs(src.cols(), out_width, filter);
+    SimpleImage output(src.rows(), out_width, channels);
+    for (int y = 0; y < src.rows(); ++y) {
+        const uint8_t* in = src.ptr<uint8_t>(y);
+        uint8_t* out = output.ptr<uint8_t>(y);
+        for (int xx = 0; xx < out_width; ++xx) {
+            const int32_t xmin = coeffs.bounds[xx * 2];
+            const int32_t xmax = coeffs.bounds[xx * 2 + 1];
+            const int64_t* k = &coeffs.kk[xx * coeffs.ksize];
+            for (int c = 0; c < channels; ++c) {
+                int64_t sum = int64_t(1) << (reference_precision - 1);
+                for (int32_t x = 0; x < xmax; ++x) {
+                    sum += in[(xmin + x) * channels + c] * k[x];
+                }
+                out[xx * channels + c] = referenceClip(sum);
+            }
+        }
+    }
+    return output;
+}
+
+SimpleImage referenceVertical(const SimpleImage& src, int out_height, const PillowResize::Filter& filter)
+{
+    const int row_bytes = src.cols() * src.channels();
+    const ReferenceCoeffs coeffs = referenceCoeffs(src.rows(), out_height, filter);
+    SimpleImage output(out_height, src.cols(), src.channels());
+    for (int yy = 0; yy < out_height; ++yy) {
+        const int32_t ymin = coeffs.bounds[yy * 2];
+        const int32_t ymax = coeffs.bounds[yy * 2 + 1];
+        const int64_t* k = &coeffs.kk[yy * coeffs.ksize];
+        uint8_t* out = output.ptr<uint8_t>(yy);
+        for (int i = 0; i < row_bytes; ++i) {
+            int64_t sum = int64_t(1) << (reference_precision - 1);
+            for (int32_t y = 0; y < ymax; ++y) {
+                sum += src.ptr<uint8_t>(ymin + y)[i] * k[y];
+            }
+            out[i] = referenceClip(sum);
+        }
+    }
+    return output;
+}
+
+int maxAbsDiff(const SimpleImage& a, const SimpleImage& b)
+{
+    if (a.cols() != b.cols() || a.rows() != b.rows() || a.channels() != b.channels()) {
+        return 256;
+    }
+    int diff = 0;
+    for (int y = 0; y < a.rows(); ++y) {
+        const uint8_t* pa = a.ptr<uint8_t>(y);
+        const uint8_t* pb = b.ptr<uint8_t>(y);
+        for (int i = 0; i < a.cols() * a.channels(); ++i) {
+            diff = std::max(diff, std::abs(pa[i] - pb[i]));
+        }
+    }
+    return diff;
+}
+
+// Every filter with more than one tap, 1 / 3 / 4 channels, up- and
+// downscales. Widths from 1 to 40 give every tap count up to the Lanczos
+// support and put the last taps of each row within 16 bytes of its end, which
+// exercises the 4-, 2- and 1-tap tails of the SIMD horizontal kernel.
+//
+// Each pass is compared on the same input: a one-level difference in the
+// intermediate rows can become two after Lanczos' negative lobes, in the old
+// resampler as much as in this one.
+CheckResult checkResample()
+{
+    CheckResult result{"resample"};
+    const PillowResize::FilterType filters[] = {PillowResize::FilterType::Bilinear,
+                                                PillowResize::FilterType::Bicubic,
+                                                PillowResize::FilterType::Lanczos};
+    const int channelCounts[] = {1, 3, 4};
+    std::vector<int> sizes;
+    for (int size = 1; size <= 40; ++size) {
+        sizes.push_back(size);
+    }
+    sizes.insert(sizes.end(), {63, 64, 97, 160, 333});
+
+    int maxDiff = 0;
+    int maxEndToEnd = 0;
+    uint32_t seed = 1;
+    for (PillowResize::FilterType type : filters) {
+        const PillowResize::Filter& filter = PillowResize::filterFor(type);
+        for (int channels : channelCounts) {
+            for (int inWidth : sizes) {
+                const int inHeight = 1 + inWidth % 13 + (inWidth > 40 ? 40 : 0);
+                const SimpleImage src = makePattern(inWidth, inHeight, channels, seed++);
+                const int outWidths[] = {1, std::max(1, inWidth / 3), std::max(1, inWidth / 2), inWidth - 1,
+                                         inWidth, inWidth + 1, inWidth * 2 + 1, 37};
+                for (int outWidth : outWidths) {
+                    if (outWidth < 1) {
+                        continue;
+                    }
+                    const SimpleImage horizontal = PillowResize::resize(src, SimpleSize(outWidth, inHeight), type);
+                    if (outWidth != inWidth) {
+                        const int diff = maxAbsDiff(horizontal, referenceHorizontal(src, outWidth, filter));
+                        maxDiff = std::max(maxDiff, diff);
+                        result.expect(diff <= 1, "filter %d, %dx%dx%d -> width %d: max |diff| %d",
+                                      static_cast<int>(type), inWidth, inHeight, channels, outWidth, diff);
+                    }
+                    for (int outHeight : {1, std::max(1, inHeight / 3), inHeight + 1, inHeight * 2 + 3}) {
+                        if (outHeight == inHeight) {
+                            continue;
+                        }
+                        const SimpleImage actual = PillowResize::resize(src, SimpleSize(outWidth, outHeight), type);
+                        const int diff = maxAbsDiff(actual, referenceVertical(horizontal, outHeight, filter));
+                        maxDiff = std::max(maxDiff, diff);
+                        result.expect(diff <= 1, "filter %d, %dx%dx%d -> %dx%d: max |diff| %d",
+                                      static_cast<int>(type), inWidth, inHeight, channels, outWidth, outHeight,
+                                      diff);
+                        if (verbose) {
+                            const SimpleImage reference = outWidth != inWidth
+                                ? referenceHorizontal(src, outWidth, filter) : src;
+                            maxEndToEnd = std::max(maxEndToEnd,
+                                                   maxAbsDiff(actual, referenceVertical(reference, outHeight, filter)));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (verbose) {
+        std::printf("  resample: max |diff| %d per pass, %d end to end\n", maxDiff, maxEndToEnd);
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Row kernels: SIMD blocks against the scalar loops they replace
+
+// c * a / 255 rounded to nearest
+uint8_t referenceMulDiv255(int c, int a)
+{
+    return static_cast<uint8_t>((c * a + 127) / 255);
+}
+
+uint8_t referenceUnpremultiply(int c, int a)
+{
+    return a == 0 ? 0 : static_cast<uint8_t>(std::min(255, (c * 255 + a / 2) / a));
+}
+
+// One pixel of cvtColorRow, as the scalar loops compute it
+void referencePixel(const uint8_t* in, uint8_t* out, simple_imgproc::ColorConversion conversion)
+{
+    using namespace simple_imgproc;
+    switch (conversion) {
+        case RGB2BGR:
+        case BGR2RGB:
+            out[0] = in[2], out[1] = in[1], out[2] = in[0];
+            break;
+        case RGBA2BGR:
+            out[0] = in[2], out[1] = in[1], out[2] = in[0];
+            break;
+        case RGBA2RGB:
+            out[0] = in[0], out[1] = in[1], out[2] = in[2];
+            break;
+        case RGB2RGBA:
+            out[0] = in[0], out[1] = in[1], out[2] = in[2], out[3] = 255;
+            break;
+        case BGR2RGBA:
+            out[0] = in[2], out[1] = in[1], out[2] = in[0], out[3] = 255;
+            break;
+        case GRAY2BGR:
+        case GRAY2RGB:
+            out[0] = out[1] = out[2] = in[0];
+            break;
+        case GRAY2RGBA:
+            out[0] = out[1] = out[2] = in[0], out[3] = 255;
+            break;
+        case RGBA2mRGBA:
+            for (int c = 0; c < 3; ++c) {
+                out[c] = referenceMulDiv255(in[c], in[3]);
+            }
+            out[3] = in[3];
+            break;
+        case mRGBA2RGBA:
+            for (int c = 0; c < 3; ++c) {
+                out[c] = referenceUnpremultiply(in[c], in[3]);
+            }
+            out[3] = in[3];
+            break;
+    }
+}
+
+void referenceCompositePixel(const uint8_t* in, uint8_t* out, const uint8_t background[3])
+{
+    for (int c = 0; c < 3; ++c) {
+        out[c] = static_cast<uint8_t>(std::min(255, in[c] + referenceMulDiv255(background[c], 255 - in[3])));
+    }
+}
+
+const char* conversionName(simple_imgproc::ColorConversion conversion)
+{
+    static const char* const names[] = {"RGB2BGR",  "BGR2RGB",  "RGBA2BGR",  "GRAY2BGR",   "RGBA2RGB",  "RGB2RGBA",
+                                        "BGR2RGBA", "GRAY2RGB", "GRAY2RGBA", "RGBA2mRGBA", "mRGBA2RGBA"};
+    return names[conversion];
+}
+
+const simple_imgproc::ColorConversion allConversions[] = {
+    simple_imgproc::RGB2BGR,  simple_imgproc::BGR2RGB,   simple_imgproc::RGBA2BGR,   simple_imgproc::GRAY2BGR,
+    simple_imgproc::RGBA2RGB, simple_imgproc::RGB2RGBA,  simple_imgproc::BGR2RGBA,   simple_imgproc::GRAY2RGB,
+    simple_imgproc::GRAY2RGBA, simple_imgproc::RGBA2mRGBA, simple_imgproc::mRGBA2RGBA};
+
+// Guard bytes after the output catch stores past the last pixel
+constexpr int guard_bytes = 64;
+constexpr uint8_t guard_value = 0xA5;
+
+const uint8_t checkBackgrounds[][3] = {{0, 0, 0}, {255, 255, 255}, {12, 128, 250}};
+
+// Runs one row kernel on count pixels of src, out of place into a guarded
+// buffer or in place in a copy of src, and compares with the reference row
+template<typename Kernel, typename Reference>
+void checkRow(CheckResult& result, const char* name, const std::vector<uint8_t>& src, int count, int srcChannels,
+              int dstChannels, bool inPlace, Kernel kernel, Reference reference)
+{
+    std::vector<uint8_t> expected(static_cast<size_t>(count) * dstChannels);
+    for (int i = 0; i < count; ++i) {
+        reference(&src[i * srcChannels], &expected[i * dstChannels]);
+    }
+
+    const size_t bytes = static_cast<size_t>(count) * dstChannels;
+    std::vector<uint8_t> buffer;
+    if (inPlace) {
+        buffer.assign(src.begin(), src.begin() + static_cast<size_t>(count) * srcChannels);
+        buffer.resize(std::max(buffer.size(), bytes) + guard_bytes, guard_value);
+        kernel(buffer.data(), buffer.data(), count);
+    } else {
+        buffer.assign(bytes + guard_bytes, guard_value);
+        kernel(src.data(), buffer.data(), count);
+    }
+
+    const bool same = std::equal(expected.begin(), expected.end(), buffer.begin());
+    bool guarded = true;
+    for (size_t i = buffer.size() - guard_bytes; i < buffer.size(); ++i) {
+        guarded = guarded && buffer[i] == guard_value;
+    }
+    result.expect(same && guarded, "%s, %d pixels%s: %s", name, count, inPlace ? " in place" : "",
+                  same ? "wrote past the row" : "differs from the scalar loop");
+}
+
+// Every conversion and compositeRow for row lengths 0..79: no SIMD block, one
+// block with every possible tail, and several blocks. Conversions that do not
+// widen the pixel are also run in place.
+CheckResult checkRowKernels()
+{
+    CheckResult result{"row kernels"};
+    uint32_t seed = 7;
+    std::vector<uint8_t> src(80 * 4);
+    for (int count = 0; count < 80; ++count) {
+        for (uint8_t& value : src) {
+            value = static_cast<uint8_t>(nextRandom(seed));
+        }
+        // Some transparent and opaque pixels among the random alpha values
+        for (int i = 0; i < count; i += 5) {
+            src[i * 4 + 3] = i % 10 == 0 ? 0 : 255;
+        }
+        for (simple_imgproc::ColorConversion conversion : allConversions) {
+            const int srcChannels = simple_imgproc::srcChannels(conversion);
+            const int dstChannels = simple_imgproc::dstChannels(conversion);
+            const auto kernel = [conversion](const uint8_t* in, uint8_t* out, int n) {
+                simple_imgproc::cvtColorRow(in, out, n, conversion);
+            };
+            const auto reference = [conversion](const uint8_t* in, uint8_t* out) {
+                referencePixel(in, out, conversion);
+            };
+            checkRow(result, conversionName(conversion), src, count, srcChannels, dstChannels, false, kernel,
+                     reference);
+            if (dstChannels <= srcChannels) {
+                checkRow(result, conversionName(conversion), src, count, srcChannels, dstChannels, true, kernel,
+                         reference);
+            }
+        }
+        for (const uint8_t* background : checkBackgrounds) {
+            const auto kernel = [background](const uint8_t* in, uint8_t* out, int n) {
+                simple_imgproc::compositeRow(in, out, n, background);
+            };
+            const auto reference = [background](const uint8_t* in, uint8_t* out) {
+                referenceCompositePixel(in, out, background);
+            };
+            checkRow(result, "composite", src, count, 4, 3, false, kernel, reference);
+            checkRow(result, "composite", src, count, 4, 3, true, kernel, reference);
+        }
+    }
+    return result;
+}
+
+// Every (c, a) pair through premultiply, unpremultiply and composite: one row
+// of 65536 pixels, pixel a * 256 + c holding c, 255 - c and c ^ 0x5A in its
+// color channels so each channel sees every pair
+CheckResult checkAlphaPairs()
+{
+    CheckResult result{"alpha pairs"};
+    const int count = 256 * 256;
+    std::vector<uint8_t> src(static_cast<size_t>(count) * 4);
+    for (int a = 0; a < 256; ++a) {
+        for (int c = 0; c < 256; ++c) {
+            uint8_t* px = &src[(a * 256 + c) * 4];
+            px[0] = static_cast<uint8_t>(c);
+            px[1] = static_cast<uint8_t>(255 - c);
+            px[2] = static_cast<uint8_t>(c ^ 0x5A);
+            px[3] = static_cast<uint8_t>(a);
+        }
+    }
+
+    std::vector<uint8_t> out(static_cast<size_t>(count) * 4);
+    for (simple_imgproc::ColorConversion conversion : {simple_imgproc::RGBA2mRGBA, simple_imgproc::mRGBA2RGBA}) {
+        simple_imgproc::cvtColorRow(src.data(), out.data(), count, conversion);
+        for (int i = 0; i < count; ++i) {
+            uint8_t expected[4];
+            referencePixel(&src[i * 4], expected, conversion);
+            result.expect(std::equal(expected, expected + 4, &out[i * 4]), "%s, c %d, a %d: %d %d %d, expected %d %d %d",
+                          conversionName(conversion), i & 255, i >> 8, out[i * 4], out[i * 4 + 1], out[i * 4 + 2],
+                          expected[0], expected[1], expected[2]);
+        }
+    }
+
+    // Background values take every value against every alpha too
+    for (int value = 0; value < 256; ++value) {
+        const uint8_t background[3] = {static_cast<uint8_t>(value), static_cast<uint8_t>(255 - value),
+                                       static_cast<uint8_t>(value ^ 0x5A)};
+        simple_imgproc::compositeRow(src.data(), out.data(), count, background);
+        for (int i = 0; i < count; ++i) {
+            uint8_t expected[3];
+            referenceCompositePixel(&src[i * 4], expected, background);
+            result.expect(std::equal(expected, expected + 3, &out[i * 3]),
+                          "composite on %d, c %d, a %d: %d %d %d, expected %d %d %d", value, i & 255, i >> 8,
+                          out[i * 3], out[i * 3 + 1], out[i * 3 + 2], expected[0], expected[1], expected[2]);
+        }
+    }
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else {
+            std::fprintf(stderr, "usage: %s [--verbose]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const CheckResult results[] = {checkResample(), checkRowKernels(), checkAlphaPairs()};
+    bool ok = true;
+    for (const CheckResult& result : results) {
+        std::printf("%-12s %8ld cases  %s\n", result.name, result.cases, result.failures ? "FAILED" : "ok");
+        ok = ok && result.failures == 0;
+    }
+    return ok ? 0 : 1;
+}
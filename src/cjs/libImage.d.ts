@@ -1,11 +1,32 @@
+import type {
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeResult,
+} from "../types/index.js";
 export declare type ModuleType = {
+  // Same fields as optimizeImage() without `image`; missing ones take their defaults
   optimize: (
     data: BufferSource | string,
-    width: number,
-    height: number,
-    quality: number,
-    format: "webp" | "jpeg" | "none",
+    options: Omit<OptimizeParams, "image">,
   ) => OptimizeResult | undefined;
+  // Reusable input region in the wasm heap (valid until the next call)
+  getInputBuffer: (size: number) => Uint8Array | null;
+  // Optimize the first `size` bytes written to getInputBuffer()
+  optimizeInput: (
+    size: number,
+    options: Omit<OptimizeParams, "image">,
+  ) => OptimizeResult | undefined;
+  // Decode the first `size` bytes written to getInputBuffer() once and produce every target
+  optimizeMany: (
+    size: number,
+    targets: OptimizeTarget[],
+    cascadeRatio: number,
+  ) => OptimizeResult[] | undefined;
+  // Read only the headers: dimensions, channels, flags and EXIF orientation
+  probe: (data: BufferSource | string) => ProbeResult | null;
+  // Probe the first `size` bytes written to getInputBuffer()
+  probeInput: (size: number) => ProbeResult | null;
   releaseResult: () => void;
 };
 
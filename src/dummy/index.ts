@@ -1,6 +1,26 @@
 import { _optimizeImage, _optimizeImageExt } from "../lib/optimizeImage.js";
-import type { OptimizeParams, OptimizeResult } from "../types/index.js";
-export type { OptimizeParams, OptimizeResult };
+import type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+} from "../types/index.js";
+export type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+};
 
 export const optimizeImage = (_params: OptimizeParams): OptimizeResult => {
   return undefined as never;
@@ -8,6 +28,14 @@ export const optimizeImage = (_params: OptimizeParams): OptimizeResult => {
 export const optimizeImageExt = (_params: OptimizeParams): OptimizeResult => {
   return undefined as never;
 };
+export const optimizeImageMany = (
+  _params: OptimizeManyParams,
+): OptimizeResult[] => {
+  return undefined as never;
+};
+export const probeImage = (_params: ProbeParams): ProbeResult => {
+  return undefined as never;
+};
 export const setLimit = (_limit: number): void => {};
 export const close = () => {};
 export const waitAll = () => Promise.resolve();
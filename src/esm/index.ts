@@ -1,7 +1,32 @@
 import LibImage from "./libImage.js";
-import { _optimizeImage, _optimizeImageExt } from "../lib/optimizeImage.js";
-import type { OptimizeParams, OptimizeResult } from "../types/index.js";
-export type { OptimizeParams, OptimizeResult };
+import {
+  _optimizeImage,
+  _optimizeImageExt,
+  _optimizeImageMany,
+  _probeImage,
+} from "../lib/optimizeImage.js";
+import type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+} from "../types/index.js";
+export type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+};
 
 const libImage = LibImage();
 
@@ -10,3 +35,9 @@ export const optimizeImage = async (params: OptimizeParams) =>
 
 export const optimizeImageExt = async (params: OptimizeParams) =>
   _optimizeImageExt({ ...params, libImage });
+
+export const optimizeImageMany = async (params: OptimizeManyParams) =>
+  _optimizeImageMany({ ...params, libImage });
+
+export const probeImage = async (params: ProbeParams) =>
+  _probeImage({ ...params, libImage });
@@ -1,48 +1,86 @@
 import type { ModuleType } from "../esm/libImage.js";
-import type { OptimizeParams } from "../types/index.js";
+import type {
+  OptimizeManyParams,
+  OptimizeParams,
+  ProbeParams,
+} from "../types/index.js";
 
 const result = (
   result: ReturnType<ModuleType["optimize"]> | undefined,
   releaseResult: () => void,
 ) => {
-  const r = result
-    ? { ...result, data: Uint8Array.from(result.data) }
-    : undefined;
+  // result.data is a view into the wasm heap; slice() makes the one copy
+  // into a JS-owned buffer before the native buffer is released
+  const r = result ? { ...result, data: result.data.slice() } : undefined;
   releaseResult();
   return r;
 };
-export const _optimizeImage = async ({
+const toBytes = (image: BufferSource | string) =>
+  typeof image === "string"
+    ? new TextEncoder().encode(image)
+    : ArrayBuffer.isView(image)
+      ? new Uint8Array(image.buffer, image.byteOffset, image.byteLength)
+      : new Uint8Array(image);
+export const _optimizeImage = async (
+  params: OptimizeParams & {
+    libImage: Promise<ModuleType>;
+  },
+) => _optimizeImageExt(params).then((r) => r?.data);
+
+// Every option but the image goes to the module as one object; missing
+// fields take the defaults documented on OptimizeParams
+export const _optimizeImageExt = async ({
   image,
-  width = 0,
-  height = 0,
-  quality = 100,
-  format = "webp",
   libImage,
+  ...options
 }: OptimizeParams & {
   libImage: Promise<ModuleType>;
 }) =>
-  _optimizeImageExt({
-    image,
-    width,
-    height,
-    quality,
-    format,
-    libImage,
-  }).then((r) => r?.data);
+  libImage.then(
+    ({ optimize, getInputBuffer, optimizeInput, releaseResult }) => {
+      if (typeof image === "string") {
+        return result(optimize(image, options), releaseResult);
+      }
+      // Write the bytes once into the reusable input region of the wasm heap
+      const bytes = toBytes(image);
+      const input = getInputBuffer(bytes.byteLength);
+      if (!input) return result(undefined, releaseResult);
+      input.set(bytes);
+      return result(optimizeInput(bytes.byteLength, options), releaseResult);
+    },
+  );
 
-export const _optimizeImageExt = async ({
+export const _optimizeImageMany = async ({
   image,
-  width = 0,
-  height = 0,
-  quality = 100,
-  format = "webp",
+  targets,
+  cascadeRatio = 2,
   libImage,
-}: OptimizeParams & {
+}: OptimizeManyParams & {
   libImage: Promise<ModuleType>;
 }) =>
-  libImage.then(({ optimize, releaseResult }) =>
-    result(
-      optimize(image, width, height, quality, format),
-      releaseResult,
-    ),
-  );
+  libImage.then(({ getInputBuffer, optimizeMany, releaseResult }) => {
+    const bytes = toBytes(image);
+    const input = getInputBuffer(bytes.byteLength);
+    if (!input) return undefined;
+    input.set(bytes);
+    const results = optimizeMany(bytes.byteLength, targets, cascadeRatio);
+    // Copy every view out before the native buffers are released
+    const r = results?.map((v) => ({ ...v, data: v.data.slice() }));
+    releaseResult();
+    return r;
+  });
+
+export const _probeImage = async ({
+  image,
+  libImage,
+}: ProbeParams & {
+  libImage: Promise<ModuleType>;
+}) =>
+  libImage.then(({ probe, getInputBuffer, probeInput }) => {
+    if (typeof image === "string") return probe(image) ?? undefined;
+    const bytes = toBytes(image);
+    const input = getInputBuffer(bytes.byteLength);
+    if (!input) return undefined;
+    input.set(bytes);
+    return probeInput(bytes.byteLength) ?? undefined;
+  });
@@ -1,19 +1,23 @@
+#ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
+#endif
 #include <webp/encode.h>
 #include <webp/decode.h>
 
-#include <webp/encode.h>
-#include <webp/decode.h>
-
-// libjpeg for JPEG decoding
+// libjpeg for JPEG decoding (jpeglib.h needs FILE from stdio)
+#include <cstdio>
 #include <jpeglib.h>
 #include <setjmp.h>
 // libpng for PNG decoding
 #include <png.h>
 #include <vector>
 #include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
 #include <libexif/exif-data.h>
 
 // WASM SIMD support
@@ -28,6 +32,8 @@
     #define HAVE_WASM_SIMD 0
 #endif
 
+#include "libImage.h"
+
 // Include simple image processing functions
 #include "simple_imgproc.h"
 #include "simple_image.h"
@@ -35,120 +41,27 @@
 // Include Pillow Resize for high-quality Lanczos resampling
 #include "pillow_resize.hpp"
 
+#ifdef __EMSCRIPTEN__
 using namespace emscripten;
 
 EM_JS(void, js_console_log, (const char *str), {
     console.log(UTF8ToString(str));
 });
-
-#if HAVE_WASM_SIMD
-// SIMD-optimized BGR to RGB conversion
-void convertBGRtoRGB_SIMD(const SimpleImage& src, SimpleImage& dst) {
-    if (src.channels() != 3) {
-        // Fallback to non-SIMD for non-RGB images
-        simple_imgproc::cvtColor(src, dst, simple_imgproc::BGR2RGB);
-        return;
-    }
-    
-    dst.create(src.rows(), src.cols(), src.channels());
-    
-    const int width = src.cols();
-    const int height = src.rows();
-    const int total_pixels = width * height;
-    
-    const uint8_t* src_data = src.data();
-    uint8_t* dst_data = dst.data();
-    
-    int i = 0;
-    // Process 16 bytes (5+ pixels) at a time with SIMD
-    for (; i <= total_pixels * 3 - 16; i += 12) {
-        // Load 12 bytes (4 BGR pixels)
-        v128_t bgr_pixels = wasm_v128_load(src_data + i);
-        
-        // Extract B, G, R channels
-        // BGR BGR BGR BGR -> B0G0R0B1 G1R1B2G2 R2B3G3R3
-        v128_t shuffled = wasm_i8x16_shuffle(bgr_pixels,
-            wasm_i32x4_splat(0), // dummy second vector
-            2, 1, 0,    // R0 G0 B0
-            5, 4, 3,    // R1 G1 B1  
-            8, 7, 6,    // R2 G2 B2
-            11, 10, 9,  // R3 G3 B3
-            14, 13, 12, // Partial next pixel
-            15          // Padding
-        );
-        
-        // Store converted RGB data
-        wasm_v128_store(dst_data + i, shuffled);
-    }
-    
-    // Process remaining pixels with scalar code
-    for (; i < total_pixels * 3; i += 3) {
-        uint8_t b = src_data[i];
-        uint8_t g = src_data[i + 1];
-        uint8_t r = src_data[i + 2];
-        
-        dst_data[i] = r;     // R
-        dst_data[i + 1] = g; // G
-        dst_data[i + 2] = b; // B
-    }
-}
-
-// SIMD-optimized RGB to BGR conversion
-void convertRGBtoBGR_SIMD(const SimpleImage& src, SimpleImage& dst) {
-    if (src.channels() != 3) {
-        // Fallback to non-SIMD for non-RGB images
-        simple_imgproc::cvtColor(src, dst, simple_imgproc::RGB2BGR);
-        return;
-    }
-    
-    dst.create(src.rows(), src.cols(), src.channels());
-    
-    const int width = src.cols();
-    const int height = src.rows();
-    const int total_pixels = width * height;
-    
-    const uint8_t* src_data = src.data();
-    uint8_t* dst_data = dst.data();
-    
-    int i = 0;
-    // Process 12 bytes (4 RGB pixels) at a time with SIMD
-    for (; i <= total_pixels * 3 - 12; i += 12) {
-        // Load 12 bytes (4 RGB pixels)
-        v128_t rgb_pixels = wasm_v128_load(src_data + i);
-        
-        // Convert RGB to BGR by shuffling
-        v128_t shuffled = wasm_i8x16_shuffle(rgb_pixels,
-            wasm_i32x4_splat(0), // dummy second vector
-            2, 1, 0,    // B0 G0 R0
-            5, 4, 3,    // B1 G1 R1  
-            8, 7, 6,    // B2 G2 R2
-            11, 10, 9,  // B3 G3 R3
-            14, 13, 12, // Partial next pixel if available
-            15          // Padding
-        );
-        
-        // Store converted BGR data
-        wasm_v128_store(dst_data + i, shuffled);
-    }
-    
-    // Process remaining pixels with scalar code
-    for (; i < total_pixels * 3; i += 3) {
-        uint8_t r = src_data[i];
-        uint8_t g = src_data[i + 1];
-        uint8_t b = src_data[i + 2];
-        
-        dst_data[i] = b;     // B
-        dst_data[i + 1] = g; // G
-        dst_data[i + 2] = r; // R
-    }
+#else
+// Native build: log to stderr instead of the JS console
+static void js_console_log(const char *str)
+{
+    std::fprintf(stderr, "%s\n", str);
 }
+#endif
 
+#if HAVE_WASM_SIMD
 // SIMD-optimized memory copy for image data
 void fastMemcpy_SIMD(uint8_t* dst, const uint8_t* src, size_t size) {
     size_t i = 0;
     
     // Process 16 bytes at a time with SIMD
-    for (; i <= size - 16; i += 16) {
+    for (; i + 16 <= size; i += 16) {
         v128_t data = wasm_v128_load(src + i);
         wasm_v128_store(dst + i, data);
     }
@@ -160,15 +73,6 @@ void fastMemcpy_SIMD(uint8_t* dst, const uint8_t* src, size_t size) {
 }
 #endif
 
-// Enum for image formats
-enum class ImageFormat {
-    JPEG,
-    PNG,
-    WEBP,
-    UNKNOWN
-};
-
-// File format detection function
 ImageFormat detectImageFormat(const uint8_t* data, size_t size) {
     if (size < 4) return ImageFormat::UNKNOWN;
     
@@ -195,631 +99,2737 @@ ImageFormat detectImageFormat(const uint8_t* data, size_t size) {
     return ImageFormat::UNKNOWN;
 }
 
-class MemoryManager
+static inline uint32_t readBE16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t readBE32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static inline uint32_t readLE16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static inline uint32_t readLE24(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16); }
+static inline uint32_t readLE32(const uint8_t* p) { return readLE24(p) | (uint32_t(p[3]) << 24); }
+
+// TIFF 構造 (Exif APP1 の "Exif\0\0" の後) から IFD0 の Orientation (SHORT) の
+// 値の位置を返す。見つからなければ 0 (値がヘッダーの 8 バイトより前に来ることはない)
+static size_t findTIFFOrientation(const uint8_t* tiff, size_t size, bool& littleEndian)
 {
-private:
-    uint8_t *m_ptr;
+    if (size < 8) {
+        return 0;
+    }
+    littleEndian = tiff[0] == 'I' && tiff[1] == 'I';
+    if (!littleEndian && !(tiff[0] == 'M' && tiff[1] == 'M')) {
+        return 0;
+    }
+    auto read16 = [&](size_t pos) { return littleEndian ? readLE16(tiff + pos) : readBE16(tiff + pos); };
+    auto read32 = [&](size_t pos) { return littleEndian ? readLE32(tiff + pos) : readBE32(tiff + pos); };
+    if (read16(2) != 42) {
+        return 0;
+    }
+    const size_t ifd = read32(4);
+    if (ifd < 8 || ifd + 2 > size) {
+        return 0;
+    }
+    const size_t count = read16(ifd);
+    for (size_t i = 0; i < count && ifd + 2 + (i + 1) * 12 <= size; ++i) {
+        const size_t entry = ifd + 2 + i * 12;
+        // tag 0x0112, type SHORT (3), count 1: the value is stored in the entry
+        if (read16(entry) == 0x0112) {
+            return read16(entry + 2) == 3 && read32(entry + 4) == 1 ? entry + 8 : 0;
+        }
+    }
+    return 0;
+}
 
-public:
-    MemoryManager()
-    {
-        m_ptr = nullptr;
+// Exif の TIFF 構造を探す: JPEG は APP1 "Exif\0\0"、PNG は eXIf チャンク、WebP は
+// VP8X の EXIF フラグが立っているときの EXIF チャンク。PNG / WebP のチャンクに
+// "Exif\0\0" を付けて書く実装もあるので、あれば読み飛ばす。見つからなければ nullptr
+static const uint8_t* findExifTIFF(const uint8_t* data, size_t size, size_t& tiffSize)
+{
+    static const uint8_t exifHeader[6] = {'E', 'x', 'i', 'f', 0, 0};
+    auto skipHeader = [&](const uint8_t* payload, size_t length) {
+        if (length >= 6 && std::memcmp(payload, exifHeader, 6) == 0) {
+            payload += 6;
+            length -= 6;
+        }
+        tiffSize = length;
+        return payload;
+    };
+    switch (detectImageFormat(data, size)) {
+        case ImageFormat::JPEG:
+            // APP1 は SOS より前にある (XMP の APP1 が先に来ることもある)
+            for (size_t pos = 2; pos + 4 <= size;) {
+                if (data[pos] != 0xFF) {
+                    return nullptr;
+                }
+                const uint8_t marker = data[pos + 1];
+                if (marker == 0xFF) {
+                    pos++;  // fill byte
+                    continue;
+                }
+                if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+                    pos += 2;  // markers without a length
+                    continue;
+                }
+                if (marker == 0xDA || marker == 0xD9) {
+                    return nullptr;
+                }
+                const size_t length = readBE16(data + pos + 2);
+                if (length < 2 || length > size - pos - 2) {
+                    return nullptr;
+                }
+                if (marker == 0xE1 && length >= 8 && std::memcmp(data + pos + 4, exifHeader, 6) == 0) {
+                    tiffSize = length - 8;
+                    return data + pos + 10;
+                }
+                pos += 2 + length;
+            }
+            return nullptr;
+        case ImageFormat::PNG:
+            // eXIf は IDAT の後に置かれることもあるので IEND まで見る (チャンクヘッダーだけを読む)
+            for (size_t pos = 8; pos + 8 <= size;) {
+                const uint8_t* chunk = data + pos;
+                const size_t length = readBE32(chunk);
+                if (length > size - pos - 8) {
+                    return nullptr;
+                }
+                if (std::memcmp(chunk + 4, "eXIf", 4) == 0) {
+                    return skipHeader(chunk + 8, length);
+                }
+                if (std::memcmp(chunk + 4, "IEND", 4) == 0) {
+                    return nullptr;
+                }
+                pos += 12 + length;
+            }
+            return nullptr;
+        case ImageFormat::WEBP:
+            // Simple (VP8 / VP8L) files carry no metadata; VP8X flags EXIF with 0x08
+            if (size < 30 || std::memcmp(data + 12, "VP8X", 4) != 0 || !(data[20] & 0x08)) {
+                return nullptr;
+            }
+            for (size_t pos = 12; pos + 8 <= size;) {
+                const uint8_t* chunk = data + pos;
+                const size_t length = readLE32(chunk + 4);
+                if (length > size - pos - 8) {
+                    return nullptr;
+                }
+                if (std::memcmp(chunk, "EXIF", 4) == 0) {
+                    return skipHeader(chunk + 8, length);
+                }
+                pos += 8 + length + (length & 1);  // chunks are padded to an even size
+            }
+            return nullptr;
+        default:
+            return nullptr;
     }
+}
 
-    uint8_t *allocate(const uint8_t *data, size_t size)
-    {
-        uint8_t *ptr = new uint8_t[size];
-#if HAVE_WASM_SIMD
-        fastMemcpy_SIMD(ptr, data, size);
-#else
-        std::memcpy(ptr, data, size);
-#endif
-        m_ptr = ptr;
-        return ptr;
+// JPEG: SOS までのマーカーをたどって SOFn を読む
+static bool probeJPEG(const uint8_t* data, size_t size, ImageInfo& info)
+{
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            return false;
+        }
+        const uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;  // fill byte
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+            pos += 2;  // markers without a length
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) {
+            return false;  // scan data reached before a frame header
+        }
+        const size_t length = readBE16(data + pos + 2);
+        // SOF0-SOF15 except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (length < 8 || pos + 2 + 8 > size) {
+                return false;
+            }
+            const uint8_t* sof = data + pos + 4;
+            info.bitDepth = sof[0];
+            info.height = static_cast<int>(readBE16(sof + 1));
+            info.width = static_cast<int>(readBE16(sof + 3));
+            info.channels = sof[5];
+            info.progressive = marker == 0xC2 || marker == 0xC6 || marker == 0xCA || marker == 0xCE;
+            info.orientation = ImageProcessor::getOrientation(reinterpret_cast<const char*>(data), size);
+            return true;
+        }
+        pos += 2 + length;
     }
+    return false;
+}
 
-    void release()
+// PNG: IHDR と、パレットの透過を示す tRNS (IDAT より前にある)
+static bool probePNG(const uint8_t* data, size_t size, ImageInfo& info)
+{
+    if (size < 33 || std::memcmp(data + 12, "IHDR", 4) != 0) {
+        return false;
+    }
+    info.width = static_cast<int>(readBE32(data + 16));
+    info.height = static_cast<int>(readBE32(data + 20));
+    info.bitDepth = data[24];
+    const uint8_t colorType = data[25];
+    info.progressive = data[28] == 1;
+    switch (colorType) {
+        case 0: info.channels = 1; break;
+        case 2: info.channels = 3; break;
+        case 3: info.channels = 3; break;
+        case 4: info.channels = 2; break;
+        case 6: info.channels = 4; break;
+        default: return false;
+    }
+    info.hasAlpha = (colorType & 4) != 0;
+    info.orientation = ImageProcessor::getOrientation(reinterpret_cast<const char*>(data), size);
+
+    for (size_t pos = 33; pos + 8 <= size && !info.hasAlpha;) {
+        const uint8_t* chunk = data + pos;
+        if (std::memcmp(chunk + 4, "IDAT", 4) == 0) {
+            break;
+        }
+        if (std::memcmp(chunk + 4, "tRNS", 4) == 0) {
+            info.hasAlpha = true;
+            if (colorType == 3) {
+                info.channels = 4;
+            }
+        }
+        // Chunk lengths are at most 2^31 - 1
+        const size_t length = readBE32(chunk);
+        if (length + 12 > size - pos) {
+            break;
+        }
+        pos += 12 + length;
+    }
+    return true;
+}
+
+// WebP: 最初のチャンク (VP8 / VP8L / VP8X) のヘッダーだけを読む
+static bool probeWEBP(const uint8_t* data, size_t size, ImageInfo& info)
+{
+    if (size < 30) {
+        return false;
+    }
+    const uint8_t* chunk = data + 12;
+    const uint8_t* payload = chunk + 8;
+    info.bitDepth = 8;
+    if (std::memcmp(chunk, "VP8 ", 4) == 0) {
+        // Key frame: 3-byte frame tag, start code 9d 01 2a, then 14-bit sizes
+        if (payload[3] != 0x9D || payload[4] != 0x01 || payload[5] != 0x2A) {
+            return false;
+        }
+        info.width = static_cast<int>(readLE16(payload + 6) & 0x3FFF);
+        info.height = static_cast<int>(readLE16(payload + 8) & 0x3FFF);
+    } else if (std::memcmp(chunk, "VP8L", 4) == 0) {
+        // Signature 0x2f, then 14-bit width - 1, 14-bit height - 1 and the alpha hint
+        if (payload[0] != 0x2F) {
+            return false;
+        }
+        const uint32_t bits = readLE32(payload + 1);
+        info.width = static_cast<int>((bits & 0x3FFF) + 1);
+        info.height = static_cast<int>(((bits >> 14) & 0x3FFF) + 1);
+        info.hasAlpha = (bits >> 28) & 1;
+    } else if (std::memcmp(chunk, "VP8X", 4) == 0) {
+        // Flags (alpha = 0x10), 3 reserved bytes, 24-bit canvas width - 1 and height - 1
+        info.hasAlpha = (payload[0] & 0x10) != 0;
+        info.width = static_cast<int>(readLE24(payload + 4) + 1);
+        info.height = static_cast<int>(readLE24(payload + 7) + 1);
+    } else {
+        return false;
+    }
+    info.channels = info.hasAlpha ? 4 : 3;
+    info.orientation = ImageProcessor::getOrientation(reinterpret_cast<const char*>(data), size);
+    return true;
+}
+
+bool probeImage(const uint8_t* data, size_t size, ImageInfo& info)
+{
+    info = ImageInfo();
+    info.format = detectImageFormat(data, size);
+    switch (info.format) {
+        case ImageFormat::JPEG:
+            return probeJPEG(data, size, info);
+        case ImageFormat::PNG:
+            return probePNG(data, size, info);
+        case ImageFormat::WEBP:
+            return probeWEBP(data, size, info);
+        default:
+            return false;
+    }
+}
+
+bool computeOutputSize(int srcWidth, int srcHeight, float width, float height, int &outWidth, int &outHeight)
+{
+    outWidth = static_cast<int>(width);
+    outHeight = static_cast<int>(height);
+
+    float aspectSrc = static_cast<float>(srcWidth) / srcHeight;
+
+    if (width > 0 && height > 0)
     {
-        if (m_ptr)
+        // Both dimensions specified - fit within bounds maintaining aspect ratio
+        float aspectDest = width / height;
+
+        if (aspectSrc > aspectDest)
+        {
+            outHeight = static_cast<int>(width / aspectSrc);
+        }
+        else
         {
-            delete[] m_ptr;
-            m_ptr = nullptr;
+            outWidth = static_cast<int>(height * aspectSrc);
         }
+
+        // Don't upscale if original image is smaller than target dimensions
+        return !(srcWidth <= outWidth && srcHeight <= outHeight);
+    }
+    if (width > 0)
+    {
+        // Only width specified - calculate height to maintain aspect ratio
+        outHeight = static_cast<int>(width / aspectSrc);
+        return srcWidth > width;
+    }
+    if (height > 0)
+    {
+        // Only height specified - calculate width to maintain aspect ratio
+        outWidth = static_cast<int>(height * aspectSrc);
+        return srcHeight > height;
     }
-};
 
-MemoryManager memoryManager;
+    // Neither specified - use original dimensions
+    outWidth = srcWidth;
+    outHeight = srcHeight;
+    return false;
+}
 
-val createResult(size_t size, const uint8_t *data, float originalWidth, float originalHeight, float width, float height)
+bool isTransposedOrientation(int orientation)
 {
-    uint8_t *ptr = memoryManager.allocate(data, size);
-    val result = val::object();
-    result.set("data", val(typed_memory_view(size, ptr)));
-    result.set("originalWidth", originalWidth);
-    result.set("originalHeight", originalHeight);
-    result.set("width", width);
-    result.set("height", height);
-    return result;
+    return simple_imgproc::isTransposed(orientation);
 }
 
-void releaseResult()
+// Orientations 2-8 change the pixel layout; other values display as stored
+static bool needsOrientation(int orientation)
 {
-    memoryManager.release();
+    return orientation >= 2 && orientation <= 8;
 }
 
-class ImageProcessor
+// The orientation reads the stored x / y axis backwards (flips, 180 degrees,
+// and the mirrored side of the 90 degree rotations / transverse)
+static bool mirrorsX(int orientation)
 {
-private:
-    SimpleImage m_image;
-    float m_originalWidth;
-    float m_originalHeight;
-    int m_orientation;
-    ImageFormat m_inputFormat;
+    return orientation == 2 || orientation == 3 || orientation == 7 || orientation == 8;
+}
 
-    // JPEG デコード (既存の実装)
-    SimpleImage decodeJPEG(const uint8_t* data, size_t size) {
-        // JPEGデコード構造体の初期化
-        struct jpeg_decompress_struct cinfo;
-        struct jpeg_error_mgr jerr;
+static bool mirrorsY(int orientation)
+{
+    return orientation == 3 || orientation == 4 || orientation == 6 || orientation == 7;
+}
 
-        cinfo.err = jpeg_std_error(&jerr);
-        jpeg_create_decompress(&cinfo);
+// Pick the largest libjpeg scale_denom (8, 4, 2) whose output still covers every target size.
+// Bounds apply to the stored image (before the EXIF orientation), like the output size.
+static void selectJPEGScale(jpeg_decompress_struct &cinfo, const std::vector<TargetSize> &targets)
+{
+    if (targets.empty())
+    {
+        return;
+    }
 
-        // メモリからJPEGを読み込み
-        jpeg_mem_src(&cinfo, data, size);
+    int outWidth = 0;
+    int outHeight = 0;
+    for (const TargetSize &target : targets)
+    {
+        int targetWidth, targetHeight;
+        if (!computeOutputSize(cinfo.image_width, cinfo.image_height, target.width, target.height, targetWidth,
+                               targetHeight))
+        {
+            // この出力には元のサイズが必要
+            return;
+        }
+        outWidth = std::max(outWidth, targetWidth);
+        outHeight = std::max(outHeight, targetHeight);
+    }
 
-        // JPEGヘッダーを読み込み
-        jpeg_read_header(&cinfo, TRUE);
+    for (unsigned int denom = 8; denom >= 2; denom /= 2)
+    {
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = denom;
+        jpeg_calc_output_dimensions(&cinfo);
+        if (static_cast<int>(cinfo.output_width) >= outWidth && static_cast<int>(cinfo.output_height) >= outHeight)
+        {
+            return;
+        }
+    }
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1;
+}
 
-        // デコード開始
-        jpeg_start_decompress(&cinfo);
+void ImageProcessor::targetSize(int srcWidth, int srcHeight, float width, float height, int &outWidth, int &outHeight, bool &needResize) const
+{
+    needResize = computeOutputSize(srcWidth, srcHeight, width, height, outWidth, outHeight);
+}
 
-        int width = cinfo.output_width;
-        int height = cinfo.output_height;
-        int channels = cinfo.output_components;
+// libjpeg のエラーを exit() ではなく longjmp で返す
+struct JPEGErrorManager {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
 
-        // SimpleImageを作成（RGBで受け取る）
-        SimpleImage rgb_image(height, width, SIMPLE_8UC3);
+static void jpegErrorExit(j_common_ptr cinfo)
+{
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    js_console_log(message);
+    longjmp(reinterpret_cast<JPEGErrorManager*>(cinfo->err)->jump, 1);
+}
 
-        // 行ごとに読み込み
-        while (cinfo.output_scanline < cinfo.output_height) {
-            unsigned char* row_pointer = rgb_image.ptr<unsigned char>(cinfo.output_scanline);
-            jpeg_read_scanlines(&cinfo, &row_pointer, 1);
-        }
+// JPEG デコード。壊れたデータ (EXIF サムネイルなど) は空の画像を返す
+SimpleImage ImageProcessor::decodeJPEG(const uint8_t* data, size_t size, const std::vector<TargetSize>& targets) {
+    // JPEGデコード構造体の初期化
+    struct jpeg_decompress_struct cinfo;
+    JPEGErrorManager jerr;
+    SimpleImage image;
 
-        // デコード終了とクリーンアップ
-        jpeg_finish_decompress(&cinfo);
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.jump)) {
         jpeg_destroy_decompress(&cinfo);
+        return SimpleImage();
+    }
 
-        // RGB から BGR への変換
-        SimpleImage bgr_image;
-#if HAVE_WASM_SIMD
-        convertRGBtoBGR_SIMD(rgb_image, bgr_image);
-#else
-        simple_imgproc::cvtColor(rgb_image, bgr_image, simple_imgproc::RGB2BGR);
-#endif
+    jpeg_create_decompress(&cinfo);
 
-        return bgr_image;
-    }
+    // メモリからJPEGを読み込み
+    jpeg_mem_src(&cinfo, data, size);
 
-    // WEBP デコード
-    SimpleImage decodeWEBP(const uint8_t* data, size_t size) {
-        int width, height;
-        // RGBで直接デコード（アルファチャンネルを避ける）
-        uint8_t* decoded = WebPDecodeRGB(data, size, &width, &height);
-        
-        if (!decoded) {
-            return SimpleImage();
-        }
+    // JPEGヘッダーを読み込み
+    jpeg_read_header(&cinfo, TRUE);
 
-        // RGB から BGR への変換
-        SimpleImage rgb_image(height, width, SIMPLE_8UC3, decoded);
-        SimpleImage bgr_image;
-#if HAVE_WASM_SIMD
-        convertRGBtoBGR_SIMD(rgb_image, bgr_image);
-#else
-        simple_imgproc::cvtColor(rgb_image, bgr_image, simple_imgproc::RGB2BGR);
-#endif
-        
-        WebPFree(decoded);
-        return bgr_image;
+    // 縮小前のサイズを元画像サイズとして記録
+    m_originalWidth = static_cast<float>(cinfo.image_width);
+    m_originalHeight = static_cast<float>(cinfo.image_height);
+
+    // Shrink-on-load: let the IDCT decode at 1/2, 1/4 or 1/8 scale as long as
+    // the result stays at or above the final size, Lanczos does the last step
+    selectJPEGScale(cinfo, targets);
+
+    // CMYK / YCCK は RGB 出力に変換できない
+    if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&cinfo);
+        js_console_log("Unsupported JPEG color space");
+        return SimpleImage();
     }
 
-    // PNG デコード (libpng使用)
-    SimpleImage decodePNG(const uint8_t* data, size_t size) {
-        // PNG読み込み用の構造体を初期化
-        png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-        if (!png) {
-            js_console_log("Failed to create PNG read struct");
-            return SimpleImage();
-        }
+    // グレースケールは 1 チャンネルのまま、それ以外は libjpeg に RGB で出力させる
+    const bool gray = cinfo.jpeg_color_space == JCS_GRAYSCALE;
+    cinfo.out_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
 
-        png_infop info = png_create_info_struct(png);
-        if (!info) {
-            png_destroy_read_struct(&png, nullptr, nullptr);
-            js_console_log("Failed to create PNG info struct");
-            return SimpleImage();
-        }
+    // デコード開始
+    jpeg_start_decompress(&cinfo);
 
-        // エラーハンドリング
-        if (setjmp(png_jmpbuf(png))) {
-            png_destroy_read_struct(&png, &info, nullptr);
-            js_console_log("PNG decoding error");
-            return SimpleImage();
-        }
+    int width = cinfo.output_width;
+    int height = cinfo.output_height;
 
-        // メモリからの読み込み設定
-        struct png_memory_read_state {
-            const uint8_t* data;
-            size_t size;
-            size_t pos;
-        };
-        
-        png_memory_read_state read_state = {data, size, 0};
-        
-        png_set_read_fn(png, &read_state, [](png_structp png_ptr, png_bytep outBytes, png_size_t byteCountToRead) {
-            png_memory_read_state* state = static_cast<png_memory_read_state*>(png_get_io_ptr(png_ptr));
-            if (state->pos + byteCountToRead <= state->size) {
-                memcpy(outBytes, state->data + state->pos, byteCountToRead);
-                state->pos += byteCountToRead;
-            } else {
-                png_error(png_ptr, "Read error");
-            }
-        });
+    // SimpleImageを作成（GRAY / RGBで直接受け取る）
+    image.create(height, width, gray ? SIMPLE_8UC1 : SIMPLE_8UC3, gray ? PixelFormat::GRAY : PixelFormat::RGB);
 
-        // PNG情報を読み込み
-        png_read_info(png, info);
+    // 行ごとに読み込み
+    while (cinfo.output_scanline < cinfo.output_height) {
+        unsigned char* row_pointer = image.ptr<unsigned char>(cinfo.output_scanline);
+        jpeg_read_scanlines(&cinfo, &row_pointer, 1);
+    }
 
-        int width = png_get_image_width(png, info);
-        int height = png_get_image_height(png, info);
-        png_byte color_type = png_get_color_type(png, info);
-        png_byte bit_depth = png_get_bit_depth(png, info);
+    // デコード終了とクリーンアップ
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
 
-        // 8ビットに正規化
-        if (bit_depth == 16) {
-            png_set_strip_16(png);
-        }
-        
-        // パレットをRGBに変換
-        if (color_type == PNG_COLOR_TYPE_PALETTE) {
-            png_set_palette_to_rgb(png);
-        }
-        
-        // グレースケールを8ビットに
-        if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
-            png_set_expand_gray_1_2_4_to_8(png);
-        }
-        
-        // 透明色をアルファチャンネルに
-        if (png_get_valid(png, info, PNG_INFO_tRNS)) {
-            png_set_tRNS_to_alpha(png);
-        }
+    return image;
+}
 
-        png_read_update_info(png, info);
+// WEBP デコード
+SimpleImage ImageProcessor::decodeWEBP(const uint8_t* data, size_t size, bool keepAlpha) {
+    int width, height;
+    if (!WebPGetInfo(data, size, &width, &height)) {
+        return SimpleImage();
+    }
 
-        // SimpleImageを作成
-        int channels = png_get_channels(png, info);
-        SimpleImage image;
-        
-        if (channels == 3) {
-            image = SimpleImage(height, width, SIMPLE_8UC3);
-        } else if (channels == 4) {
-            image = SimpleImage(height, width, SIMPLE_8UC4);
-        } else if (channels == 1) {
-            image = SimpleImage(height, width, SIMPLE_8UC1);
-        } else {
-            png_destroy_read_struct(&png, &info, nullptr);
-            js_console_log("Unsupported PNG channel count");
+    // アルファを残す場合は RGBA でデコードし、全画素不透明なら RGB に落とす
+    WebPBitstreamFeatures features;
+    if (keepAlpha && WebPGetFeatures(data, size, &features) == VP8_STATUS_OK && features.has_alpha) {
+        SimpleImage rgba_image(height, width, SIMPLE_8UC4, PixelFormat::RGBA);
+        const int rgba_stride = width * 4;
+        if (!WebPDecodeRGBAInto(data, size, rgba_image.data(), static_cast<size_t>(rgba_stride) * height,
+                                rgba_stride)) {
             return SimpleImage();
         }
-
-        // 行ごとに読み込み
-        std::vector<png_bytep> row_pointers(height);
-        for (int y = 0; y < height; y++) {
-            row_pointers[y] = image.ptr<png_byte>(y);
+        if (!simple_imgproc::isOpaque(rgba_image)) {
+            return rgba_image;
         }
+        SimpleImage opaque_image;
+        simple_imgproc::cvtColor(rgba_image, opaque_image, simple_imgproc::RGBA2RGB);
+        return opaque_image;
+    }
 
-        png_read_image(png, row_pointers.data());
-        png_read_end(png, nullptr);
-        png_destroy_read_struct(&png, &info, nullptr);
+    // 作業バッファへRGBで直接デコード（アルファチャンネルを避ける）
+    SimpleImage rgb_image(height, width, SIMPLE_8UC3, PixelFormat::RGB);
+    const int stride = width * 3;
+    if (!WebPDecodeRGBInto(data, size, rgb_image.data(), static_cast<size_t>(stride) * height, stride)) {
+        return SimpleImage();
+    }
+    return rgb_image;
+}
 
-        // RGBA を BGR に変換
-        if (channels == 4) {
-            SimpleImage result;
-#if HAVE_WASM_SIMD
-            // RGBA to BGR は複雑なので、通常の関数を使用
-            simple_imgproc::cvtColor(image, result, simple_imgproc::RGBA2BGR);
-#else
-            simple_imgproc::cvtColor(image, result, simple_imgproc::RGBA2BGR);
-#endif
-            return result;
-        } else if (channels == 3) {
-            SimpleImage result;
-#if HAVE_WASM_SIMD
-            convertRGBtoBGR_SIMD(image, result);
-#else
-            simple_imgproc::cvtColor(image, result, simple_imgproc::RGB2BGR);
-#endif
-            return result;
-        } else {
-            // グレースケールをBGRに変換
-            SimpleImage result;
-            simple_imgproc::cvtColor(image, result, simple_imgproc::GRAY2BGR);
-            return result;
-        }
+// libpng のメモリ読み込み
+struct PNGMemoryReadState {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+};
+
+static void readPNGFromMemory(png_structp png_ptr, png_bytep outBytes, png_size_t byteCountToRead)
+{
+    PNGMemoryReadState* state = static_cast<PNGMemoryReadState*>(png_get_io_ptr(png_ptr));
+    if (state->pos + byteCountToRead <= state->size) {
+        memcpy(outBytes, state->data + state->pos, byteCountToRead);
+        state->pos += byteCountToRead;
+    } else {
+        png_error(png_ptr, "Read error");
     }
+}
 
-public:
-    ImageProcessor(const std::string &imageData)
-    {
-        const uint8_t* data = reinterpret_cast<const uint8_t*>(imageData.c_str());
-        size_t data_size = imageData.size();
-        
-        // ファイル形式を検出
-        m_inputFormat = detectImageFormat(data, data_size);
-        
-        // 形式に応じてデコード
-        switch (m_inputFormat) {
-            case ImageFormat::JPEG:
-                // 画像の向きを取得 (JPEG のみ EXIF サポート)
-                m_orientation = getOrientation(imageData.c_str(), imageData.size());
-                m_image = decodeJPEG(data, data_size);
-                break;
-                
-            case ImageFormat::WEBP:
-                m_orientation = 1; // WEBP は向き情報なし、デフォルト
-                m_image = decodeWEBP(data, data_size);
-                break;
-                
-            case ImageFormat::PNG:
-                m_orientation = 1; // PNG は向き情報なし、デフォルト  
-                m_image = decodePNG(data, data_size);
-                break;
-                
-            default:
-                js_console_log("Unsupported image format");
-                return;
-        }
-
-        if (m_image.empty()) {
-            js_console_log("Failed to decode image");
-            return;
-        }
+// PNG デコード (libpng使用)
+SimpleImage ImageProcessor::decodePNG(const uint8_t* data, size_t size, bool keepAlpha) {
+    // PNG読み込み用の構造体を初期化
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png) {
+        js_console_log("Failed to create PNG read struct");
+        return SimpleImage();
+    }
 
-        m_originalWidth = static_cast<float>(m_image.cols());
-        m_originalHeight = static_cast<float>(m_image.rows());
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_read_struct(&png, nullptr, nullptr);
+        js_console_log("Failed to create PNG info struct");
+        return SimpleImage();
     }
 
-    int getOrientation(const char *data, size_t size)
-    {
-        int orientation = 1;
-        ExifData *ed = exif_data_new_from_data((const unsigned char *)data, size);
-        if (!ed)
-        {
-            return orientation;
+    // エラーハンドリング
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        js_console_log("PNG decoding error");
+        return SimpleImage();
+    }
+
+    // メモリからの読み込み設定
+    PNGMemoryReadState read_state = {data, size, 0};
+    png_set_read_fn(png, &read_state, readPNGFromMemory);
+
+    // PNG情報を読み込み
+    png_read_info(png, info);
+
+    int width = png_get_image_width(png, info);
+    int height = png_get_image_height(png, info);
+    png_byte color_type = png_get_color_type(png, info);
+    png_byte bit_depth = png_get_bit_depth(png, info);
+
+    // 8ビットに正規化
+    if (bit_depth == 16) {
+        png_set_strip_16(png);
+    }
+    
+    // パレットをRGBに変換
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png);
+    }
+    
+    // グレースケールを8ビットに
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
+        png_set_expand_gray_1_2_4_to_8(png);
+    }
+
+    // keepAlpha ではアルファ (tRNS を含む) を RGBA に展開する。グレーも RGBA にそろえる
+    const bool gray = !(color_type & PNG_COLOR_MASK_COLOR);
+    const bool alpha = keepAlpha && ((color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS));
+    if (alpha) {
+        if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+            png_set_tRNS_to_alpha(png);
         }
-        ExifEntry *entry = exif_content_get_entry(ed->ifd[EXIF_IFD_0], EXIF_TAG_ORIENTATION);
-        if (entry)
-        {
-            orientation = exif_get_short(entry->data, exif_data_get_byte_order(entry->parent->parent));
+        if (gray) {
+            png_set_gray_to_rgb(png);
         }
-        exif_data_unref(ed);
-        return orientation;
+    } else if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+        // グレー+アルファのアルファは捨てる。グレーは 1 チャンネルのまま、RGBA はデコード後に RGB へ変換する
+        png_set_strip_alpha(png);
     }
+    png_set_interlace_handling(png);
 
-    bool isValid() const
-    {
-        return !m_image.empty();
+    png_read_update_info(png, info);
+
+    const int channels = png_get_channels(png, info);
+    if (channels != 1 && channels != 3 && channels != 4) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        js_console_log("Unsupported PNG channel count");
+        return SimpleImage();
     }
 
-    SimpleImage resize(float width, float height)
-    {
-        if (m_image.empty())
-        {
-            return SimpleImage();
-        }
+    // SimpleImageを作成 (libpng の出力チャンネル数のまま)
+    SimpleImage image(height, width, channels);
 
-        int originalWidth = m_image.cols();
-        int originalHeight = m_image.rows();
-        int outWidth = static_cast<int>(width);
-        int outHeight = static_cast<int>(height);
+    // 行ごとに読み込み
+    std::vector<png_bytep> row_pointers(height);
+    for (int y = 0; y < height; y++) {
+        row_pointers[y] = image.ptr<png_byte>(y);
+    }
 
-        // Maintain aspect ratio when only one dimension is specified or both are specified
-        float aspectSrc = static_cast<float>(originalWidth) / originalHeight;
-        
-        if (width > 0 && height > 0)
-        {
-            // Both dimensions specified - fit within bounds maintaining aspect ratio
-            float aspectDest = width / height;
+    png_read_image(png, row_pointers.data());
+    png_read_end(png, nullptr);
+    png_destroy_read_struct(&png, &info, nullptr);
 
-            if (aspectSrc > aspectDest)
-            {
-                outHeight = static_cast<int>(width / aspectSrc);
-            }
-            else
-            {
-                outWidth = static_cast<int>(height * aspectSrc);
-            }
-            
-            // Don't upscale if original image is smaller than target dimensions
-            if (originalWidth <= outWidth && originalHeight <= outHeight)
-            {
-                return applyOrientation(m_image.clone());
-            }
+    if (channels != 4) {
+        return image;
+    }
+    if (alpha && !simple_imgproc::isOpaque(image)) {
+        return image;
+    }
+    // 不透明: グレーは 1 チャンネル、それ以外は RGB に戻す
+    SimpleImage opaque_image;
+    if (alpha && gray) {
+        opaque_image.create(height, width, SIMPLE_8UC1, PixelFormat::GRAY);
+        const uint8_t* src = image.data();
+        uint8_t* dst = opaque_image.data();
+        for (size_t i = 0, n = static_cast<size_t>(width) * height; i < n; i++) {
+            dst[i] = src[i * 4];
         }
-        else if (width > 0 && height <= 0)
-        {
-            // Only width specified - calculate height to maintain aspect ratio
-            outHeight = static_cast<int>(width / aspectSrc);
-            
-            // Don't upscale if original width is smaller than target width
-            if (originalWidth <= width)
-            {
-                return applyOrientation(m_image.clone());
-            }
+    } else {
+        simple_imgproc::cvtColor(image, opaque_image, simple_imgproc::RGBA2RGB);
+    }
+    return opaque_image;
+}
+
+ImageProcessor::ImageProcessor(const uint8_t* data, size_t data_size, float targetWidth, float targetHeight,
+                               bool keepAlpha)
+    : ImageProcessor(data, data_size, std::vector<TargetSize>{TargetSize{targetWidth, targetHeight}}, keepAlpha)
+{
+}
+
+ImageProcessor::ImageProcessor(const uint8_t* data, size_t data_size, const std::vector<TargetSize>& targets,
+                               bool keepAlpha)
+{
+    m_originalWidth = 0;
+    m_originalHeight = 0;
+    m_orientation = 1;
+
+    // ファイル形式を検出
+    m_inputFormat = detectImageFormat(data, data_size);
+
+    // 画像の向きを取得 (JPEG APP1 / PNG eXIf / WebP EXIF)
+    m_orientation = getOrientation(reinterpret_cast<const char*>(data), data_size);
+
+    // 形式に応じてデコード
+    switch (m_inputFormat) {
+        case ImageFormat::JPEG:
+            m_image = decodeJPEG(data, data_size, targets);
+            break;
+            
+        case ImageFormat::WEBP:
+            m_image = decodeWEBP(data, data_size, keepAlpha);
+            break;
+            
+        case ImageFormat::PNG:
+            m_image = decodePNG(data, data_size, keepAlpha);
+            break;
+            
+        default:
+            js_console_log("Unsupported image format");
+            return;
+    }
+
+    if (m_image.empty()) {
+        js_console_log("Failed to decode image");
+        return;
+    }
+
+    // JPEG は縮小デコードの前にヘッダーから元画像サイズを記録済み
+    if (m_inputFormat != ImageFormat::JPEG) {
+        m_originalWidth = static_cast<float>(m_image.cols());
+        m_originalHeight = static_cast<float>(m_image.rows());
+    }
+}
+
+int ImageProcessor::getOrientation(const char *data, size_t size)
+{
+    // IFD0 の Orientation だけを読む。libexif のように IFD 全体 (maker note を含む) は構築しない
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    size_t tiffSize = 0;
+    const uint8_t* tiff = findExifTIFF(bytes, size, tiffSize);
+    bool littleEndian = false;
+    const size_t pos = tiff ? findTIFFOrientation(tiff, tiffSize, littleEndian) : 0;
+    if (pos == 0)
+    {
+        return 1;
+    }
+    const int orientation = static_cast<int>(littleEndian ? readLE16(tiff + pos) : readBE16(tiff + pos));
+    return orientation >= 1 && orientation <= 8 ? orientation : 1;
+}
+
+void ImageProcessor::outputSize(float width, float height, int &outWidth, int &outHeight) const
+{
+    // Output size is derived from the original dimensions so that shrink-on-load
+    // does not change the result size
+    bool needResize;
+    targetSize(static_cast<int>(m_originalWidth), static_cast<int>(m_originalHeight),
+               width, height, outWidth, outHeight, needResize);
+    if (!needResize)
+    {
+        outWidth = static_cast<int>(m_originalWidth);
+        outHeight = static_cast<int>(m_originalHeight);
+    }
+}
+
+// Premultiplied RGBA back to straight RGBA, or composited onto background
+// (0xRRGGBB) as RGB when it is not negative
+static SimpleImage fromPremultiplied(const SimpleImage& image, int background)
+{
+    SimpleImage result;
+    if (background < 0) {
+        simple_imgproc::cvtColor(image, result, simple_imgproc::mRGBA2RGBA);
+    } else {
+        const uint8_t color[3] = {static_cast<uint8_t>(background >> 16), static_cast<uint8_t>(background >> 8),
+                                  static_cast<uint8_t>(background)};
+        simple_imgproc::composite(image, result, color);
+    }
+    return result;
+}
+
+SimpleImage ImageProcessor::resize(float width, float height, PillowResize::FilterType filter, float reducingGap,
+                                   int background)
+{
+    if (m_image.empty())
+    {
+        return SimpleImage();
+    }
+
+    int outWidth, outHeight;
+    outputSize(width, height, outWidth, outHeight);
+
+    // RGBA is resampled premultiplied so transparent pixels do not bleed
+    // their (meaningless) color into the edges
+    const bool alpha = m_image.channels() == 4;
+    SimpleImage premultiplied;
+    if (alpha) {
+        simple_imgproc::cvtColor(m_image, premultiplied, simple_imgproc::RGBA2mRGBA);
+    }
+
+    // Resampling from pillow-resize (Lanczos unless another filter is requested).
+    // The last pass writes the rows at the EXIF orientation; without a resize
+    // this is a single oriented copy.
+    SimpleImage resizedImage = PillowResize::resize(alpha ? premultiplied : m_image, SimpleSize(outWidth, outHeight),
+                                                    filter, reducingGap, m_orientation);
+    
+    if (resizedImage.empty()) {
+        js_console_log("Pillow resize failed");
+        return SimpleImage();
+    }
+
+    return alpha ? fromPremultiplied(resizedImage, background) : resizedImage;
+}
+
+bool ImageProcessor::isOutputUnchanged(float width, float height) const
+{
+    int outWidth, outHeight;
+    outputSize(width, height, outWidth, outHeight);
+    return m_image.cols() == outWidth && m_image.rows() == outHeight && !needsOrientation(m_orientation);
+}
+
+// 速度・圧縮率の設定 (jpeg_set_defaults / jpeg_set_quality の後に呼ぶ)
+static void setJPEGOptions(jpeg_compress_struct& cinfo, const EncoderOptions& options)
+{
+    // 輝度の標本化係数で色差の間引きを決める (グレースケールは 1x1 のまま)
+    if (cinfo.num_components == 3) {
+        cinfo.comp_info[0].h_samp_factor = options.subsampling == ChromaSubsampling::YUV444 ? 1 : 2;
+        cinfo.comp_info[0].v_samp_factor = options.subsampling == ChromaSubsampling::YUV420 ? 2 : 1;
+    }
+    cinfo.dct_method = options.dctMethod == DctMethod::IntegerFast ? JDCT_IFAST
+                       : options.dctMethod == DctMethod::Float     ? JDCT_FLOAT
+                                                                    : JDCT_ISLOW;
+    cinfo.optimize_coding = options.optimizeCoding ? TRUE : FALSE;
+    cinfo.restart_interval = static_cast<unsigned int>(std::max(options.restartInterval, 0));
+    // Progressive scans are written from the coefficients libjpeg buffers
+    // for the whole image, so rows can still be pushed one at a time
+    if (options.progressive) {
+        jpeg_simple_progression(&cinfo);
+    }
+}
+
+// Scanline JPEG encoder (RGB rows, or gray rows written as a 1-component
+// JPEG), shared by encodeJPEG and the streaming pipeline
+class JPEGRowEncoder
+{
+private:
+    struct jpeg_compress_struct m_cinfo;
+    struct jpeg_error_mgr m_jerr;
+    unsigned char* m_buffer;
+    unsigned long m_size;
+
+public:
+    JPEGRowEncoder(int width, int height, int quality, const EncoderOptions& options, int channels = 3)
+        : m_buffer(nullptr), m_size(0)
+    {
+        m_cinfo.err = jpeg_std_error(&m_jerr);
+        jpeg_create_compress(&m_cinfo);
+
+        // メモリ出力の設定
+        jpeg_mem_dest(&m_cinfo, &m_buffer, &m_size);
+
+        // 画像サイズと形式の設定
+        m_cinfo.image_width = width;
+        m_cinfo.image_height = height;
+        m_cinfo.input_components = channels == 1 ? 1 : 3;
+        m_cinfo.in_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+
+        jpeg_set_defaults(&m_cinfo);
+        jpeg_set_quality(&m_cinfo, quality, TRUE);
+        setJPEGOptions(m_cinfo, options);
+
+        // 圧縮開始
+        jpeg_start_compress(&m_cinfo, TRUE);
+    }
+
+    ~JPEGRowEncoder()
+    {
+        jpeg_destroy_compress(&m_cinfo);
+        if (m_buffer) {
+            free(m_buffer);
+        }
+    }
+
+    JPEGRowEncoder(const JPEGRowEncoder&) = delete;
+    JPEGRowEncoder& operator=(const JPEGRowEncoder&) = delete;
+
+    void writeRow(const uint8_t* row)
+    {
+        JSAMPROW row_pointer = const_cast<JSAMPLE*>(row);
+        jpeg_write_scanlines(&m_cinfo, &row_pointer, 1);
+    }
+
+    // The buffer allocated by jpeg_mem_dest is handed over as is
+    EncodedBuffer finish()
+    {
+        jpeg_finish_compress(&m_cinfo);
+        EncodedBuffer result(m_buffer, m_size);
+        m_buffer = nullptr;
+        return result;
+    }
+};
+
+// JPEG エンコード関数 (RGB / グレーはそのまま、BGR は行単位で並べ替えて渡す)
+EncodedBuffer encodeJPEG(const SimpleImage& image, int quality, const EncoderOptions& options) {
+    if (image.channels() != 1 && image.channels() != 3) {
+        js_console_log("JPEG encoder expects a 1 or 3-channel image");
+        return EncodedBuffer();
+    }
+
+    JPEGRowEncoder encoder(image.cols(), image.rows(), quality, options, image.channels());
+    if (image.pixelFormat() == PixelFormat::BGR) {
+        std::vector<uint8_t> row(static_cast<size_t>(image.cols()) * 3);
+        for (int y = 0; y < image.rows(); ++y) {
+            simple_imgproc::cvtColorRow(image.ptr<uint8_t>(y), row.data(), image.cols(), simple_imgproc::BGR2RGB);
+            encoder.writeRow(row.data());
+        }
+    } else {
+        for (int y = 0; y < image.rows(); ++y) {
+            encoder.writeRow(image.ptr<uint8_t>(y));
+        }
+    }
+    return encoder.finish();
+}
+
+// WebPEncodeRGB / WebPEncodeLosslessRGB と同じ初期値 (可逆は品質 70) から設定を変える
+static bool setWebPConfig(WebPConfig& config, float quality, bool lossless, const EncoderOptions& options)
+{
+    if (!WebPConfigPreset(&config, WEBP_PRESET_DEFAULT, lossless ? 70.0f : quality)) {
+        return false;
+    }
+    config.method = std::clamp(options.method, 0, 6);
+    config.pass = std::clamp(options.pass, 1, 10);
+    config.segments = std::clamp(options.segments, 1, 4);
+    config.thread_level = options.threadLevel != 0 ? 1 : 0;
+    config.use_sharp_yuv = options.sharpYuv ? 1 : 0;
+    if (lossless) {
+        if (options.losslessLevel >= 0) {
+            WebPConfigLosslessPreset(&config, std::min(options.losslessLevel, 9));
+        }
+        config.lossless = 1;
+        config.near_lossless = std::clamp(options.nearLossless, 0, 100);
+    }
+    if (!WebPValidateConfig(&config)) {
+        js_console_log("Invalid WebP encoder options");
+        return false;
+    }
+    return true;
+}
+
+// Encode a picture whose pixels are set (ready: the import succeeded) and free it
+static EncodedBuffer encodePicture(const WebPConfig& config, WebPPicture& picture, bool ready)
+{
+    WebPMemoryWriter writer;
+    WebPMemoryWriterInit(&writer);
+    picture.writer = WebPMemoryWrite;
+    picture.custom_ptr = &writer;
+
+    const bool encoded = ready && WebPEncode(&config, &picture);
+    WebPPictureFree(&picture);
+
+    if (!encoded || writer.size == 0) {
+        WebPMemoryWriterClear(&writer);
+        return EncodedBuffer();
+    }
+
+    // libwebp のバッファをコピーせずに所有する
+    return EncodedBuffer(writer.mem, writer.size, WebPFree);
+}
+
+// JPEG YCbCr is full range, WebP YUV is BT.601 limited range (Y 16-235, UV 16-240)
+struct LimitedRangeTables {
+    uint8_t luma[256];
+    uint8_t chroma[256];
+
+    LimitedRangeTables()
+    {
+        for (int v = 0; v < 256; ++v) {
+            luma[v] = static_cast<uint8_t>(16 + std::lround(v * 219 / 255.0));
+            chroma[v] = static_cast<uint8_t>(128 + std::lround((v - 128) * 224 / 255.0));
+        }
+    }
+};
+
+// Gray pixels straight into the picture: Y only (neutral chroma) for lossy,
+// opaque gray ARGB for lossless. No RGB -> YUV conversion is needed.
+static bool importGray(WebPPicture& picture, const SimpleImage& image)
+{
+    if (!WebPPictureAlloc(&picture)) {
+        return false;
+    }
+    const int width = image.cols();
+    if (picture.use_argb) {
+        for (int y = 0; y < image.rows(); ++y) {
+            const uint8_t* src = image.ptr<uint8_t>(y);
+            uint32_t* dst = picture.argb + static_cast<size_t>(y) * picture.argb_stride;
+            for (int x = 0; x < width; ++x) {
+                dst[x] = 0xff000000u | src[x] * 0x010101u;
+            }
+        }
+        return true;
+    }
+
+    static const LimitedRangeTables tables;
+    for (int y = 0; y < image.rows(); ++y) {
+        const uint8_t* src = image.ptr<uint8_t>(y);
+        uint8_t* dst = picture.y + static_cast<size_t>(y) * picture.y_stride;
+        for (int x = 0; x < width; ++x) {
+            dst[x] = tables.luma[src[x]];
+        }
+    }
+    const int uvHeight = (image.rows() + 1) / 2;
+    for (int y = 0; y < uvHeight; ++y) {
+        std::memset(picture.u + static_cast<size_t>(y) * picture.uv_stride, 128, (width + 1) / 2);
+        std::memset(picture.v + static_cast<size_t>(y) * picture.uv_stride, 128, (width + 1) / 2);
+    }
+    return true;
+}
+
+// WEBP エンコード関数（可逆・非可逆対応、RGB / BGR / グレーをそのまま渡す）
+EncodedBuffer encodeWEBP(const SimpleImage& image, float quality, bool lossless, const EncoderOptions& options) {
+    if (image.channels() != 1 && image.channels() != 3 && image.channels() != 4) {
+        js_console_log("WebP encoder expects a 1, 3 or 4-channel image");
+        return EncodedBuffer();
+    }
+
+    WebPConfig config;
+    WebPPicture picture;
+    if (!setWebPConfig(config, quality, lossless, options) || !WebPPictureInit(&picture)) {
+        return EncodedBuffer();
+    }
+    picture.use_argb = lossless ? 1 : 0;
+    picture.width = image.cols();
+    picture.height = image.rows();
+    if (image.channels() == 1) {
+        return encodePicture(config, picture, importGray(picture, image));
+    }
+    if (image.channels() == 4) {
+        // Straight RGBA: libwebp keeps the alpha plane (lossy: separately compressed)
+        return encodePicture(config, picture, WebPPictureImportRGBA(&picture, image.data(), image.cols() * 4));
+    }
+
+    const int stride = image.cols() * 3;
+    const bool imported = image.pixelFormat() == PixelFormat::BGR ? WebPPictureImportBGR(&picture, image.data(), stride)
+                                                                  : WebPPictureImportRGB(&picture, image.data(), stride);
+    return encodePicture(config, picture, imported);
+}
+
+bool parseEncoderPreset(const std::string& name, EncoderOptions& options)
+{
+    if (name == "default") {
+        options = EncoderOptions();
+    } else if (name == "fast") {
+        // Interactive uploads: low-effort analysis, baseline JPEG with the fast DCT
+        options = EncoderOptions();
+        options.method = 1;
+        options.threadLevel = 1;
+        options.losslessLevel = 1;
+        options.dctMethod = DctMethod::IntegerFast;
+    } else if (name == "max") {
+        // Offline batch: smallest output regardless of encode time
+        options = EncoderOptions();
+        options.method = 6;
+        options.pass = 10;
+        options.sharpYuv = true;
+        options.losslessLevel = 9;
+        options.progressive = true;
+        options.optimizeCoding = true;
+    } else {
+        js_console_log("Supported encoder presets: default, fast, max");
+        return false;
+    }
+    return true;
+}
+
+// 出力形式に応じたエンコード
+static EncodedBuffer encodeOutput(const SimpleImage& image, float quality, const std::string& format,
+                                  ImageFormat inputFormat, const EncoderOptions& encoder)
+{
+    EncodedBuffer data;
+
+    // 入力形式に応じて圧縮設定を決定
+    bool shouldUseLossless = (inputFormat == ImageFormat::PNG || inputFormat == ImageFormat::WEBP);
+    
+    if (format == "webp") {
+        // WEBP出力：入力形式に応じて可逆/非可逆を選択
+        data = encodeWEBP(image, quality, shouldUseLossless, encoder);
+        
+        if (shouldUseLossless) {
+            js_console_log("Using lossless WebP compression for PNG/WebP input");
+        }
+    } else if (format == "jpeg") {
+        // JPEG出力：常に非可逆圧縮
+        data = encodeJPEG(image, static_cast<int>(quality), encoder);
+        js_console_log("Using JPEG compression");
+    }
+    return data;
+}
+
+// Lossy encodes tried after the first one when searching a byte budget
+constexpr int quality_search_steps = 7;
+
+// Size model of the search: log(bytes) is roughly linear in quality, the
+// slope is the prior until two encodes bracket the budget
+constexpr double quality_log_slope = 0.03;
+
+// Lossy encode of the same image at a given quality
+using LossyEncoder = std::function<EncodedBuffer(int quality)>;
+
+// Keep data (encoded at quality, lossless or not) when it fits maxBytes
+// (0 = no budget); otherwise search the lossy quality below it, keeping the
+// highest quality that fits. Without one that fits within the steps, the
+// smallest output tried is returned. usedQuality receives the quality of the result.
+static EncodedBuffer searchWithinBytes(EncodedBuffer data, float quality, bool lossless, size_t maxBytes,
+                                       const LossyEncoder& encodeLossy, float& usedQuality)
+{
+    usedQuality = quality;
+    if (maxBytes == 0 || data.empty() || data.size() <= maxBytes) {
+        return data;
+    }
+
+    const double target = std::log(static_cast<double>(maxBytes));
+
+    // lo: highest quality known to fit (-1: none yet), hi: lowest quality over budget.
+    // A lossless first encode says nothing about lossy sizes, so the search
+    // starts with a lossy encode at the requested quality.
+    const int requested = std::clamp(static_cast<int>(quality), 0, 100);
+    int lo = -1;
+    int hi = lossless ? requested + 1 : requested;
+    double loLog = 0;
+    double hiLog = std::log(static_cast<double>(data.size()));
+    EncodedBuffer best;
+    EncodedBuffer over = std::move(data);
+    int overQuality = hi;
+    int lastSide = 0;
+    int repeats = 0;
+
+    for (int step = 0; step < quality_search_steps && hi - lo > 1; ++step) {
+        int q;
+        if (lossless && step == 0) {
+            q = requested;
+        } else if (repeats >= 2) {
+            // The model keeps missing on one side: bisect instead
+            q = (lo + hi) / 2;
+        } else {
+            const double guess = lo < 0 ? hi + (target - hiLog) / quality_log_slope
+                                 : hiLog > loLog ? lo + (hi - lo) * (target - loLog) / (hiLog - loLog)
+                                                 : (lo + hi) / 2;
+            q = std::clamp(static_cast<int>(std::lround(guess)), lo + 1, hi - 1);
+        }
+
+        EncodedBuffer candidate = encodeLossy(q);
+        if (candidate.empty()) {
+            return candidate;
+        }
+        const double sizeLog = std::log(static_cast<double>(candidate.size()));
+        const int side = candidate.size() <= maxBytes ? 1 : -1;
+        repeats = side == lastSide ? repeats + 1 : 1;
+        lastSide = side;
+        if (side > 0) {
+            lo = q;
+            loLog = sizeLog;
+            best = std::move(candidate);
+        } else {
+            hi = q;
+            hiLog = sizeLog;
+            over = std::move(candidate);
+            overQuality = q;
+        }
+    }
+
+    if (!best.empty()) {
+        usedQuality = static_cast<float>(lo);
+        return best;
+    }
+    usedQuality = static_cast<float>(std::min(overQuality, 100));
+    return over;
+}
+
+// Encode within maxBytes (0 = no budget). The first encode uses the requested
+// quality (lossless WebP for PNG / WebP input), the search re-encodes the same image.
+static EncodedBuffer encodeWithinBytes(const SimpleImage& image, float quality, const std::string& format,
+                                       ImageFormat inputFormat, size_t maxBytes, const EncoderOptions& encoder,
+                                       float& usedQuality)
+{
+    const bool lossless = format == "webp" && (inputFormat == ImageFormat::PNG || inputFormat == ImageFormat::WEBP);
+    return searchWithinBytes(encodeOutput(image, quality, format, inputFormat, encoder), quality, lossless, maxBytes,
+                             [&](int q) {
+                                 return format == "webp" ? encodeWEBP(image, static_cast<float>(q), false, encoder)
+                                                         : encodeJPEG(image, q, encoder);
+                             },
+                             usedQuality);
+}
+
+// Output side of the streaming pipeline. Decoded RGB (or gray) scanlines go
+// through the row-streaming resizer; the resized rows are written straight to libjpeg when
+// no rotation is needed, otherwise the (output sized) image is collected with
+// each row stored at the EXIF orientation as it arrives.
+class StreamingPipeline
+{
+private:
+    float m_width;
+    float m_height;
+    float m_quality;
+    std::string m_format;
+    PillowResize::FilterType m_filter;
+    float m_reducingGap;
+    size_t m_maxBytes;
+    EncoderOptions m_encoder;
+    ImageFormat m_inputFormat;
+    int m_orientation;
+    float m_originalWidth;
+    float m_originalHeight;
+
+    std::unique_ptr<PillowResize::StreamingResizer> m_resizer;
+    std::unique_ptr<JPEGRowEncoder> m_jpeg;
+    SimpleImage m_output;
+    std::unique_ptr<simple_imgproc::OrientedRowWriter> m_writer;
+    int m_outWidth;
+    int m_outHeight;
+    int m_channels;
+
+public:
+    StreamingPipeline(float width, float height, float quality, const std::string& format,
+                      PillowResize::FilterType filter, float reducingGap, size_t maxBytes,
+                      const EncoderOptions& encoder, ImageFormat inputFormat, int orientation)
+        : m_width(width), m_height(height), m_quality(quality), m_format(format), m_filter(filter),
+          m_reducingGap(reducingGap), m_maxBytes(maxBytes), m_encoder(encoder), m_inputFormat(inputFormat),
+          m_orientation(orientation),
+          m_originalWidth(0), m_originalHeight(0), m_outWidth(0), m_outHeight(0), m_channels(3)
+    {
+    }
+
+    int orientation() const { return m_orientation; }
+    float width() const { return m_width; }
+    float height() const { return m_height; }
+
+    // srcWidth/srcHeight: scanline size (after shrink-on-load); channels: 1 (gray) or 3 (RGB)
+    bool begin(int srcWidth, int srcHeight, float originalWidth, float originalHeight, int channels)
+    {
+        m_originalWidth = originalWidth;
+        m_originalHeight = originalHeight;
+        m_channels = channels;
+
+        // Output size is derived from the original dimensions, as in ImageProcessor::resize
+        if (!computeOutputSize(static_cast<int>(originalWidth), static_cast<int>(originalHeight), m_width, m_height,
+                               m_outWidth, m_outHeight))
+        {
+            m_outWidth = static_cast<int>(originalWidth);
+            m_outHeight = static_cast<int>(originalHeight);
+        }
+        if (m_outWidth < 1 || m_outHeight < 1)
+        {
+            js_console_log("Invalid output size");
+            return false;
+        }
+
+        // A byte budget may need several encodes of the output, so it is collected
+        PillowResize::StreamingResizer::RowSink sink;
+        if (m_format == "jpeg" && !needsOrientation(m_orientation) && m_maxBytes == 0)
+        {
+            m_jpeg.reset(new JPEGRowEncoder(m_outWidth, m_outHeight, static_cast<int>(m_quality), m_encoder,
+                                            m_channels));
+            sink = [this](const uint8_t* row, int32_t) { m_jpeg->writeRow(row); };
+        }
+        else
+        {
+            // 出力行はその場で EXIF の向きに書き込む
+            const SimpleSize size = simple_imgproc::orientedSize(m_outWidth, m_outHeight, m_orientation);
+            m_output.create(size.height, size.width, m_channels,
+                            m_channels == 1 ? PixelFormat::GRAY : PixelFormat::RGB);
+            m_writer.reset(new simple_imgproc::OrientedRowWriter(m_output, m_outWidth, m_outHeight, m_orientation));
+            sink = [this](const uint8_t* row, int32_t) {
+                std::memcpy(m_writer->row(), row, static_cast<size_t>(m_outWidth) * m_channels);
+                m_writer->commit();
+            };
+        }
+        m_resizer.reset(new PillowResize::StreamingResizer(srcWidth, srcHeight, m_channels,
+                                                           SimpleSize(m_outWidth, m_outHeight), sink, m_filter,
+                                                           m_reducingGap));
+        return true;
+    }
+
+    void pushRow(const uint8_t* row) { m_resizer->pushRow(row); }
+
+    bool done() const { return m_resizer && m_resizer->done(); }
+
+    bool finish(OptimizedImage& result)
+    {
+        if (!done())
+        {
+            js_console_log("Image data ended before the last row");
+            return false;
+        }
+
+        result.originalWidth = m_originalWidth;
+        result.originalHeight = m_originalHeight;
+
+        if (m_jpeg)
+        {
+            result.data = m_jpeg->finish();
+            result.quality = m_quality;
+            js_console_log("Using JPEG compression");
+            result.width = static_cast<float>(m_outWidth);
+            result.height = static_cast<float>(m_outHeight);
+        }
+        else
+        {
+            m_writer->flush();
+            result.data = encodeWithinBytes(m_output, m_quality, m_format, m_inputFormat, m_maxBytes, m_encoder,
+                                            result.quality);
+            result.width = static_cast<float>(m_output.cols());
+            result.height = static_cast<float>(m_output.rows());
+        }
+
+        if (result.data.empty()) {
+            js_console_log("Failed to encode image");
+            return false;
+        }
+        return true;
+    }
+};
+
+enum class StreamStatus {
+    Done,
+    Unsupported,    // Needs the full decode (WebP, interlaced PNG, CMYK JPEG)
+    Failed
+};
+
+static StreamStatus streamJPEG(const uint8_t* data, size_t size, StreamingPipeline& pipeline)
+{
+    struct jpeg_decompress_struct cinfo;
+    JPEGErrorManager jerr;
+    std::vector<uint8_t> row;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return StreamStatus::Failed;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, size);
+    jpeg_read_header(&cinfo, TRUE);
+
+    // CMYK / YCCK は RGB 出力に変換できない。グレースケールは 1 チャンネルのまま流す
+    if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&cinfo);
+        return StreamStatus::Unsupported;
+    }
+    cinfo.out_color_space = cinfo.jpeg_color_space == JCS_GRAYSCALE ? JCS_GRAYSCALE : JCS_RGB;
+
+    selectJPEGScale(cinfo, {TargetSize{pipeline.width(), pipeline.height()}});
+    jpeg_start_decompress(&cinfo);
+
+    if (!pipeline.begin(cinfo.output_width, cinfo.output_height,
+                        static_cast<float>(cinfo.image_width), static_cast<float>(cinfo.image_height),
+                        cinfo.output_components)) {
+        jpeg_destroy_decompress(&cinfo);
+        return StreamStatus::Failed;
+    }
+
+    row.resize(static_cast<size_t>(cinfo.output_width) * cinfo.output_components);
+    while (cinfo.output_scanline < cinfo.output_height && !pipeline.done()) {
+        JSAMPROW row_pointer = row.data();
+        jpeg_read_scanlines(&cinfo, &row_pointer, 1);
+        pipeline.pushRow(row.data());
+    }
+
+    // 出力に寄与しない残りの行はデコードしない
+    if (cinfo.output_scanline < cinfo.output_height) {
+        jpeg_abort_decompress(&cinfo);
+    } else {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return StreamStatus::Done;
+}
+
+static StreamStatus streamPNG(const uint8_t* data, size_t size, StreamingPipeline& pipeline, bool keepAlpha)
+{
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png) {
+        js_console_log("Failed to create PNG read struct");
+        return StreamStatus::Failed;
+    }
+
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_read_struct(&png, nullptr, nullptr);
+        js_console_log("Failed to create PNG info struct");
+        return StreamStatus::Failed;
+    }
+
+    PNGMemoryReadState read_state = {data, size, 0};
+    std::vector<uint8_t> row;
+    std::vector<uint8_t> rgb_row;
+
+    // エラーハンドリング
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        js_console_log("PNG decoding error");
+        return StreamStatus::Failed;
+    }
+
+    png_set_read_fn(png, &read_state, readPNGFromMemory);
+    png_read_info(png, info);
+
+    int width = png_get_image_width(png, info);
+    int height = png_get_image_height(png, info);
+    png_byte color_type = png_get_color_type(png, info);
+    png_byte bit_depth = png_get_bit_depth(png, info);
+
+    // インターレース画像は全体を展開する必要がある。アルファを残す場合も
+    // 不透明かどうかを全体で判定するため全体デコードに回す
+    if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE ||
+        (keepAlpha && ((color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS)))) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return StreamStatus::Unsupported;
+    }
+
+    // 全ての形式を 8 ビットのグレー / RGB の行に揃える (decodePNG と同じ結果)
+    if (bit_depth == 16) {
+        png_set_strip_16(png);
+    }
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png);
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
+        png_set_expand_gray_1_2_4_to_8(png);
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+        png_set_strip_alpha(png);
+    }
+    png_read_update_info(png, info);
+
+    const int channels = png_get_channels(png, info);
+    if (channels != 1 && channels != 3 && channels != 4) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return StreamStatus::Unsupported;
+    }
+
+    if (!pipeline.begin(width, height, static_cast<float>(width), static_cast<float>(height), channels == 1 ? 1 : 3)) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return StreamStatus::Failed;
+    }
+
+    // グレー / RGB の行はそのまま、RGBA の行は SIMD の変換で RGB にしてから渡す
+    row.resize(png_get_rowbytes(png, info));
+    rgb_row.resize(channels == 4 ? static_cast<size_t>(width) * 3 : 0);
+    for (int y = 0; y < height && !pipeline.done(); ++y) {
+        png_read_row(png, row.data(), nullptr);
+        if (channels != 4) {
+            pipeline.pushRow(row.data());
+        } else {
+            simple_imgproc::cvtColorRow(row.data(), rgb_row.data(), width, simple_imgproc::RGBA2RGB);
+            pipeline.pushRow(rgb_row.data());
+        }
+    }
+
+    png_destroy_read_struct(&png, &info, nullptr);
+    return StreamStatus::Done;
+}
+
+// Decoded block size of a component; libjpeg 7+ scales each axis separately
+static int scaledBlockWidth(const jpeg_component_info& comp)
+{
+#if JPEG_LIB_VERSION >= 70
+    return comp.DCT_h_scaled_size;
+#else
+    return comp.DCT_scaled_size;
+#endif
+}
+
+static int scaledBlockHeight(const jpeg_component_info& comp)
+{
+#if JPEG_LIB_VERSION >= 70
+    return comp.DCT_v_scaled_size;
+#else
+    return comp.DCT_scaled_size;
+#endif
+}
+
+// 3-component YCbCr whose chroma is subsampled by at most 2 from the luma
+// (4:2:0, 4:2:2, 4:4:0, 4:4:4); the raw planes can be resampled as they are
+static bool isPlanarJPEG(const jpeg_decompress_struct& cinfo)
+{
+    if (cinfo.jpeg_color_space != JCS_YCbCr || cinfo.num_components != 3 ||
+        cinfo.max_h_samp_factor > 2 || cinfo.max_v_samp_factor > 2) {
+        return false;
+    }
+    const jpeg_component_info* comp = cinfo.comp_info;
+    return comp[0].h_samp_factor == cinfo.max_h_samp_factor && comp[0].v_samp_factor == cinfo.max_v_samp_factor &&
+           comp[1].h_samp_factor == 1 && comp[1].v_samp_factor == 1 &&
+           comp[2].h_samp_factor == 1 && comp[2].v_samp_factor == 1;
+}
+
+// Luma samples per chroma sample, horizontally and vertically
+static SimpleSize subsamplingFactors(ChromaSubsampling subsampling)
+{
+    return SimpleSize(subsampling == ChromaSubsampling::YUV444 ? 1 : 2,
+                      subsampling == ChromaSubsampling::YUV420 ? 2 : 1);
+}
+
+// Y, Cb and Cr planes; chroma at its subsampled size
+struct PlanarImage {
+    SimpleImage planes[3];
+};
+
+// JPEG from planes whose chroma size matches options.subsampling. The planes
+// are handed to jpeg_write_raw_data one iMCU row at a time, padded to whole
+// blocks by repeating the last column and row.
+static EncodedBuffer encodeJPEGPlanes(const PlanarImage& image, int quality, const EncoderOptions& options)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+
+    cinfo.image_width = image.planes[0].cols();
+    cinfo.image_height = image.planes[0].rows();
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    setJPEGOptions(cinfo, options);
+    cinfo.raw_data_in = TRUE;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    std::vector<uint8_t> blocks[3];
+    std::vector<JSAMPROW> rows[3];
+    JSAMPARRAY planes[3];
+    for (int c = 0; c < 3; ++c) {
+        const jpeg_component_info& comp = cinfo.comp_info[c];
+        const size_t stride = static_cast<size_t>(comp.width_in_blocks) * DCTSIZE;
+        rows[c].resize(static_cast<size_t>(comp.v_samp_factor) * DCTSIZE);
+        blocks[c].resize(stride * rows[c].size());
+        for (size_t r = 0; r < rows[c].size(); ++r) {
+            rows[c][r] = blocks[c].data() + r * stride;
+        }
+        planes[c] = rows[c].data();
+    }
+
+    const JDIMENSION lines = static_cast<JDIMENSION>(cinfo.max_v_samp_factor) * DCTSIZE;
+    for (int group = 0; cinfo.next_scanline < cinfo.image_height; ++group) {
+        for (int c = 0; c < 3; ++c) {
+            const SimpleImage& plane = image.planes[c];
+            const size_t stride = static_cast<size_t>(cinfo.comp_info[c].width_in_blocks) * DCTSIZE;
+            const int count = static_cast<int>(rows[c].size());
+            for (int r = 0; r < count; ++r) {
+                const uint8_t* src = plane.ptr<uint8_t>(std::min(group * count + r, plane.rows() - 1));
+                std::memcpy(rows[c][r], src, plane.cols());
+                std::memset(rows[c][r] + plane.cols(), src[plane.cols() - 1], stride - plane.cols());
+            }
+        }
+        jpeg_write_raw_data(&cinfo, planes, lines);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return EncodedBuffer(buffer, size);
+}
+
+// Lossy WebP from YUV420 planes in WebP's limited range; libwebp reads the
+// planes in place (use_argb = 0), there is no RGB -> YUV conversion
+static EncodedBuffer encodeWEBPPlanes(PlanarImage& image, float quality, const EncoderOptions& options)
+{
+    WebPConfig config;
+    WebPPicture picture;
+    if (!setWebPConfig(config, quality, false, options) || !WebPPictureInit(&picture)) {
+        return EncodedBuffer();
+    }
+    picture.use_argb = 0;
+    picture.colorspace = WEBP_YUV420;
+    picture.width = image.planes[0].cols();
+    picture.height = image.planes[0].rows();
+    picture.y = image.planes[0].data();
+    picture.u = image.planes[1].data();
+    picture.v = image.planes[2].data();
+    picture.y_stride = image.planes[0].cols();
+    picture.uv_stride = image.planes[1].cols();
+    return encodePicture(config, picture, true);
+}
+
+// JPEG -> JPEG / WebP without leaving YCbCr. libjpeg hands over the raw
+// planes (no upsampling, no color conversion), each plane goes through its
+// own row-streaming resizer (chroma at chroma resolution) into the output
+// planes at the EXIF orientation, and the encoders take the planes as they
+// are. Unsupported when the JPEG is not planar (isPlanarJPEG).
+static StreamStatus optimizeJPEGPlanar(const uint8_t* data, size_t size, float width, float height, float quality,
+                                       const std::string& format, PillowResize::FilterType filter,
+                                       float reducingGap, size_t maxBytes, const EncoderOptions& encoder,
+                                       int orientation, OptimizedImage& result)
+{
+    static const LimitedRangeTables ranges;
+
+    struct jpeg_decompress_struct cinfo;
+    JPEGErrorManager jerr;
+    const bool webp = format == "webp";
+    PlanarImage output;
+    std::unique_ptr<simple_imgproc::OrientedRowWriter> writers[3];
+    std::unique_ptr<PillowResize::StreamingResizer> resizers[3];
+    std::vector<uint8_t> blocks[3];
+    std::vector<JSAMPROW> rows[3];
+    JSAMPARRAY planes[3];
+    int pushed[3] = {0, 0, 0};
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return StreamStatus::Failed;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, size);
+    jpeg_read_header(&cinfo, TRUE);
+    if (!isPlanarJPEG(cinfo)) {
+        jpeg_destroy_decompress(&cinfo);
+        return StreamStatus::Unsupported;
+    }
+
+    cinfo.raw_data_out = TRUE;
+    selectJPEGScale(cinfo, {TargetSize{width, height}});
+    jpeg_start_decompress(&cinfo);
+
+    int outWidth, outHeight;
+    if (!computeOutputSize(cinfo.image_width, cinfo.image_height, width, height, outWidth, outHeight)) {
+        outWidth = cinfo.image_width;
+        outHeight = cinfo.image_height;
+    }
+    if (outWidth < 1 || outHeight < 1) {
+        js_console_log("Invalid output size");
+        jpeg_destroy_decompress(&cinfo);
+        return StreamStatus::Failed;
+    }
+
+    // Plane sizes before orientation. The subsampling applies to the
+    // displayed image, so 4:2:2 stays horizontal after a 90 degree rotation.
+    SimpleSize factors = subsamplingFactors(webp ? ChromaSubsampling::YUV420 : encoder.subsampling);
+    if (isTransposedOrientation(orientation)) {
+        std::swap(factors.width, factors.height);
+    }
+    const SimpleSize chroma((outWidth + factors.width - 1) / factors.width,
+                            (outHeight + factors.height - 1) / factors.height);
+    const SimpleSize sizes[3] = {SimpleSize(outWidth, outHeight), chroma, chroma};
+
+    // A chroma sample covers factors luma samples on both sides, so an odd
+    // sized plane ends past the luma edge at the displayed right / bottom;
+    // the chroma resizers take the matching source box, which may reach past
+    // the decoded chroma plane (at its start when the orientation mirrors
+    // that stored axis)
+    const jpeg_component_info& luma = cinfo.comp_info[0];
+    const double scaleX = static_cast<double>(luma.downsampled_width) / outWidth;
+    const double scaleY = static_cast<double>(luma.downsampled_height) / outHeight;
+    const bool mirrorX = mirrorsX(orientation);
+    const bool mirrorY = mirrorsY(orientation);
+
+    for (int c = 0; c < 3; ++c) {
+        const jpeg_component_info& comp = cinfo.comp_info[c];
+        double boxX = 0;
+        double boxY = 0;
+        double boxWidth = 0;
+        double boxHeight = 0;
+        if (c > 0) {
+            const double sourceX = static_cast<double>(cinfo.max_h_samp_factor * scaledBlockWidth(luma)) /
+                                   (comp.h_samp_factor * scaledBlockWidth(comp));
+            const double sourceY = static_cast<double>(cinfo.max_v_samp_factor * scaledBlockHeight(luma)) /
+                                   (comp.v_samp_factor * scaledBlockHeight(comp));
+            boxWidth = chroma.width * factors.width * scaleX / sourceX;
+            boxHeight = chroma.height * factors.height * scaleY / sourceY;
+            if (mirrorX) {
+                boxX = luma.downsampled_width / sourceX - boxWidth;
+            }
+            if (mirrorY) {
+                boxY = luma.downsampled_height / sourceY - boxHeight;
+            }
+        }
+        const SimpleSize oriented = simple_imgproc::orientedSize(sizes[c].width, sizes[c].height, orientation);
+        output.planes[c].create(oriented.height, oriented.width, SIMPLE_8UC1, PixelFormat::GRAY);
+        writers[c].reset(new simple_imgproc::OrientedRowWriter(output.planes[c], sizes[c].width, sizes[c].height,
+                                                                orientation));
+
+        simple_imgproc::OrientedRowWriter* writer = writers[c].get();
+        const uint8_t* lut = !webp ? nullptr : c == 0 ? ranges.luma : ranges.chroma;
+        const int rowWidth = sizes[c].width;
+        PillowResize::StreamingResizer::RowSink sink = [writer, lut, rowWidth](const uint8_t* row, int32_t) {
+            uint8_t* out = writer->row();
+            if (lut) {
+                for (int x = 0; x < rowWidth; ++x) {
+                    out[x] = lut[row[x]];
+                }
+            } else {
+                std::memcpy(out, row, rowWidth);
+            }
+            writer->commit();
+        };
+        resizers[c].reset(new PillowResize::StreamingResizer(comp.downsampled_width, comp.downsampled_height, 1,
+                                                             sizes[c], sink, filter, reducingGap, boxX, boxY,
+                                                             boxWidth, boxHeight));
+
+        // One iMCU row of the component, whole MCUs wide
+        const int mcuWidth = comp.h_samp_factor;
+        const size_t stride = static_cast<size_t>((comp.width_in_blocks + mcuWidth - 1) / mcuWidth * mcuWidth) *
+                              scaledBlockWidth(comp);
+        rows[c].resize(static_cast<size_t>(comp.v_samp_factor) * scaledBlockHeight(comp));
+        blocks[c].resize(stride * rows[c].size());
+        for (size_t r = 0; r < rows[c].size(); ++r) {
+            rows[c][r] = blocks[c].data() + r * stride;
+        }
+        planes[c] = rows[c].data();
+    }
+
+    auto done = [&]() { return resizers[0]->done() && resizers[1]->done() && resizers[2]->done(); };
+    while (cinfo.output_scanline < cinfo.output_height && !done()) {
+        jpeg_read_raw_data(&cinfo, planes, static_cast<JDIMENSION>(rows[0].size()));
+        for (int c = 0; c < 3; ++c) {
+            const int count = std::min(static_cast<int>(rows[c].size()),
+                                       static_cast<int>(cinfo.comp_info[c].downsampled_height) - pushed[c]);
+            for (int r = 0; r < count && !resizers[c]->done(); ++r) {
+                resizers[c]->pushRow(rows[c][r]);
+            }
+            pushed[c] += count;
+        }
+    }
+
+    // 出力に寄与しない残りの行はデコードしない
+    if (cinfo.output_scanline < cinfo.output_height) {
+        jpeg_abort_decompress(&cinfo);
+    } else {
+        jpeg_finish_decompress(&cinfo);
+    }
+    result.originalWidth = static_cast<float>(cinfo.image_width);
+    result.originalHeight = static_cast<float>(cinfo.image_height);
+    jpeg_destroy_decompress(&cinfo);
+
+    if (!done()) {
+        js_console_log("Image data ended before the last row");
+        return StreamStatus::Failed;
+    }
+    for (auto& writer : writers) {
+        writer->flush();
+    }
+
+    auto encodePlanes = [&](float q) {
+        return webp ? encodeWEBPPlanes(output, q, encoder) : encodeJPEGPlanes(output, static_cast<int>(q), encoder);
+    };
+    result.data = searchWithinBytes(encodePlanes(quality), quality, false, maxBytes,
+                                    [&](int q) { return encodePlanes(static_cast<float>(q)); }, result.quality);
+    result.width = static_cast<float>(output.planes[0].cols());
+    result.height = static_cast<float>(output.planes[0].rows());
+    if (result.data.empty()) {
+        js_console_log("Failed to encode image");
+        return StreamStatus::Failed;
+    }
+    js_console_log(webp ? "Using planar YUV WebP compression" : "Using planar YCbCr JPEG compression");
+    return StreamStatus::Done;
+}
+
+// 格納時の軸を反転すると、その方向の奇数次の係数の符号が反転する
+static void coefficientSigns(bool flipX, bool flipY, JCOEF signs[DCTSIZE2])
+{
+    for (int v = 0; v < DCTSIZE; ++v) {
+        for (int u = 0; u < DCTSIZE; ++u) {
+            signs[v * DCTSIZE + u] = (flipX && (u & 1)) != (flipY && (v & 1)) ? -1 : 1;
+        }
+    }
+}
+
+// Flips without a transpose: swaps two blocks with the signs applied (a == b
+// transforms one block in place)
+static void flipBlocks(JCOEF* a, JCOEF* b, const JCOEF signs[DCTSIZE2])
+{
+    for (int k = 0; k < DCTSIZE2; ++k) {
+        const JCOEF first = a[k];
+        a[k] = static_cast<JCOEF>(b[k] * signs[k]);
+        b[k] = static_cast<JCOEF>(first * signs[k]);
+    }
+}
+
+static void transposeBlock(const JCOEF* src, JCOEF* dst, const JCOEF signs[DCTSIZE2])
+{
+    for (int v = 0; v < DCTSIZE; ++v) {
+        for (int u = 0; u < DCTSIZE; ++u) {
+            dst[u * DCTSIZE + v] = static_cast<JCOEF>(src[v * DCTSIZE + u] * signs[v * DCTSIZE + u]);
+        }
+    }
+}
+
+static bool markerHasPrefix(const jpeg_saved_marker_ptr marker, int code, const char* prefix, size_t length)
+{
+    return marker->marker == code && marker->data_length >= length && std::memcmp(marker->data, prefix, length) == 0;
+}
+
+static JDIMENSION roundUpBlocks(JDIMENSION blocks, int factor)
+{
+    return (blocks + factor - 1) / factor * factor;
+}
+
+EncodedBuffer transformJPEG(const uint8_t* data, size_t size, int orientation, bool keepMetadata,
+                            const EncoderOptions& options)
+{
+    struct jpeg_decompress_struct src = {};
+    struct jpeg_compress_struct dst = {};
+    JPEGErrorManager jerr;
+    jvirt_barray_ptr dstArrays[MAX_COMPONENTS];
+    unsigned char* buffer = nullptr;
+    unsigned long length = 0;
+
+    // 入力と出力で同じエラーマネージャを使う
+    src.err = jpeg_std_error(&jerr.pub);
+    dst.err = &jerr.pub;
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        free(buffer);
+        return EncodedBuffer();
+    }
+
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+    jpeg_mem_src(&src, data, size);
+    // keepMetadata では APPn / COM をすべて、それ以外は ICC プロファイル (APP2) だけを残す
+    if (keepMetadata) {
+        jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+        for (int m = 0; m < 16; ++m) {
+            jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+        }
+    } else {
+        jpeg_save_markers(&src, JPEG_APP0 + 2, 0xFFFF);
+    }
+    jpeg_read_header(&src, TRUE);
+
+    // 反転する軸の端が MCU の途中で終わると、端の部分ブロックを反対側へ移せない
+    const bool transpose = isTransposedOrientation(orientation);
+    const bool flipX = mirrorsX(orientation);
+    const bool flipY = mirrorsY(orientation);
+    bool exact = (!flipX || src.image_width % (src.max_h_samp_factor * DCTSIZE) == 0) &&
+                 (!flipY || src.image_height % (src.max_v_samp_factor * DCTSIZE) == 0);
+#if JPEG_LIB_VERSION >= 70
+    exact = exact && src.block_size == DCTSIZE;
+#endif
+    if (!exact) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        return EncodedBuffer();
+    }
+
+    // Flips rearrange the input coefficients in place; a transpose writes to
+    // output arrays, requested before jpeg_read_coefficients realizes them
+    const int components = src.num_components;
+    for (int c = 0; transpose && c < components; ++c) {
+        const jpeg_component_info& comp = src.comp_info[c];
+        dstArrays[c] = (*src.mem->request_virt_barray)(
+            reinterpret_cast<j_common_ptr>(&src), JPOOL_IMAGE, FALSE,
+            roundUpBlocks(comp.height_in_blocks, comp.v_samp_factor),
+            roundUpBlocks(comp.width_in_blocks, comp.h_samp_factor), comp.h_samp_factor);
+    }
+    jvirt_barray_ptr* srcArrays = jpeg_read_coefficients(&src);
+    j_common_ptr common = reinterpret_cast<j_common_ptr>(&src);
+    JCOEF signs[DCTSIZE2];
+    coefficientSigns(flipX, flipY, signs);
+
+    for (int c = 0; c < components; ++c) {
+        const jpeg_component_info& comp = src.comp_info[c];
+        const JDIMENSION srcWidth = comp.width_in_blocks;
+        const JDIMENSION srcHeight = comp.height_in_blocks;
+        if (!transpose) {
+            // 上下の行の組 (上下反転しない場合は各行自身) の間で、左右反転した位置のブロックを入れ替える
+            for (JDIMENSION top = 0; top < srcHeight && (flipX || flipY); ++top) {
+                const JDIMENSION bottom = flipY ? srcHeight - 1 - top : top;
+                if (bottom < top) {
+                    break;
+                }
+                JBLOCKROW upper = (*src.mem->access_virt_barray)(common, srcArrays[c], top, 1, TRUE)[0];
+                JBLOCKROW lower = (*src.mem->access_virt_barray)(common, srcArrays[c], bottom, 1, TRUE)[0];
+                for (JDIMENSION x = 0; x < srcWidth; ++x) {
+                    const JDIMENSION mirrored = flipX ? srcWidth - 1 - x : x;
+                    // 同じ行の中では左右の組を一度だけ入れ替える
+                    if (top == bottom && mirrored < x) {
+                        break;
+                    }
+                    flipBlocks(upper[x], lower[mirrored], signs);
+                }
+            }
+            continue;
+        }
+
+        // Output blocks in strips of one output iMCU row; an output column
+        // comes from one input row
+        const JDIMENSION dstWidth = srcHeight;
+        const JDIMENSION dstHeight = srcWidth;
+        const JDIMENSION strip = comp.h_samp_factor;
+        for (JDIMENSION top = 0; top < dstHeight; top += strip) {
+            JBLOCKARRAY dstRows = (*src.mem->access_virt_barray)(common, dstArrays[c], top, strip, TRUE);
+            const JDIMENSION rows = std::min(strip, dstHeight - top);
+            for (JDIMENSION dx = 0; dx < dstWidth; ++dx) {
+                const JDIMENSION sy = flipY ? srcHeight - 1 - dx : dx;
+                JBLOCKROW srcRow = (*src.mem->access_virt_barray)(common, srcArrays[c], sy, 1, FALSE)[0];
+                for (JDIMENSION r = 0; r < rows; ++r) {
+                    const JDIMENSION dy = top + r;
+                    transposeBlock(srcRow[flipX ? srcWidth - 1 - dy : dy], dstRows[r][dx], signs);
+                }
+            }
+        }
+    }
+
+    // Same tables, sampling and color space as the input; a transpose swaps
+    // the dimensions, the sampling factors and the quantization tables
+#if JPEG_LIB_VERSION >= 80
+    jpeg_core_output_dimensions(&src);
+#elif JPEG_LIB_VERSION >= 70
+    src.output_width = src.image_width;
+    src.output_height = src.image_height;
+#endif
+    jpeg_copy_critical_parameters(&src, &dst);
+    if (transpose) {
+        std::swap(dst.image_width, dst.image_height);
+#if JPEG_LIB_VERSION >= 70
+        std::swap(dst.jpeg_width, dst.jpeg_height);
+        std::swap(dst.min_DCT_h_scaled_size, dst.min_DCT_v_scaled_size);
+#endif
+        for (int c = 0; c < components; ++c) {
+            std::swap(dst.comp_info[c].h_samp_factor, dst.comp_info[c].v_samp_factor);
+        }
+        for (int t = 0; t < NUM_QUANT_TBLS; ++t) {
+            JQUANT_TBL* table = dst.quant_tbl_ptrs[t];
+            for (int v = 0; table && v < DCTSIZE; ++v) {
+                for (int u = v + 1; u < DCTSIZE; ++u) {
+                    std::swap(table->quantval[v * DCTSIZE + u], table->quantval[u * DCTSIZE + v]);
+                }
+            }
+        }
+    }
+    dst.optimize_coding = options.optimizeCoding ? TRUE : FALSE;
+    if (options.progressive || src.progressive_mode) {
+        jpeg_simple_progression(&dst);
+    }
+
+    jpeg_mem_dest(&dst, &buffer, &length);
+    jpeg_write_coefficients(&dst, transpose ? dstArrays : srcArrays);
+
+    // 保存したマーカーを書き戻す。libjpeg 自身が書く JFIF / Adobe は重複させず、
+    // Exif の Orientation は 1 にする
+    for (jpeg_saved_marker_ptr marker = src.marker_list; marker; marker = marker->next) {
+        if ((dst.write_JFIF_header && markerHasPrefix(marker, JPEG_APP0, "JFIF", 5)) ||
+            (dst.write_Adobe_marker && markerHasPrefix(marker, JPEG_APP0 + 14, "Adobe", 5)) ||
+            (!keepMetadata && !markerHasPrefix(marker, JPEG_APP0 + 2, "ICC_PROFILE", 12))) {
+            continue;
+        }
+        if (markerHasPrefix(marker, JPEG_APP0 + 1, "Exif\0", 6)) {
+            bool littleEndian;
+            const size_t pos = findTIFFOrientation(marker->data + 6, marker->data_length - 6, littleEndian);
+            if (pos) {
+                marker->data[6 + pos] = littleEndian ? 1 : 0;
+                marker->data[6 + pos + 1] = littleEndian ? 0 : 1;
+            }
+        }
+        jpeg_write_marker(&dst, marker->marker, marker->data, marker->data_length);
+    }
+
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    return EncodedBuffer(buffer, length);
+}
+
+// Orientation-only JPEG -> JPEG without a re-encode (losslessOrientation).
+// false when the output needs a resize or no orientation, the transform is
+// not exact or the result exceeds maxBytes; the caller then takes the normal path.
+static bool optimizeJPEGLossless(const uint8_t* data, size_t size, const ImageInfo& info, float width, float height,
+                                 size_t maxBytes, const EncoderOptions& encoder, bool keepMetadata,
+                                 OptimizedImage& result)
+{
+    int outWidth, outHeight;
+    if (info.format != ImageFormat::JPEG || !needsOrientation(info.orientation) ||
+        computeOutputSize(info.width, info.height, width, height, outWidth, outHeight)) {
+        return false;
+    }
+    EncodedBuffer transformed = transformJPEG(data, size, info.orientation, keepMetadata, encoder);
+    if (transformed.empty() || (maxBytes > 0 && transformed.size() > maxBytes)) {
+        return false;
+    }
+    const SimpleSize displaySize = simple_imgproc::orientedSize(info.width, info.height, info.orientation);
+    result.data = std::move(transformed);
+    result.originalWidth = static_cast<float>(info.width);
+    result.originalHeight = static_cast<float>(info.height);
+    result.width = static_cast<float>(displaySize.width);
+    result.height = static_cast<float>(displaySize.height);
+    js_console_log("Using lossless JPEG orientation");
+    return true;
+}
+
+// Small outputs from the embedded EXIF thumbnail (useThumbnail). false when the
+// input has no JPEG thumbnail, the output needs no resize or is larger than the
+// thumbnail, or the thumbnail's aspect ratio differs from the main image
+// (e.g. a letterboxed 4:3 thumbnail of a 16:9 photo); the caller then decodes
+// the full image.
+static bool optimizeJPEGThumbnail(const uint8_t* data, size_t size, const ImageInfo& info, float width, float height,
+                                  float quality, const std::string& format, PillowResize::FilterType filter,
+                                  float reducingGap, size_t maxBytes, const EncoderOptions& encoder,
+                                  OptimizedImage& result)
+{
+    int outWidth, outHeight;
+    if (info.format != ImageFormat::JPEG || format == "none" ||
+        !computeOutputSize(info.width, info.height, width, height, outWidth, outHeight)) {
+        return false;
+    }
+    ExifData* ed = exif_data_new_from_data(data, static_cast<unsigned int>(size));
+    if (!ed) {
+        return false;
+    }
+
+    // サムネイルは本画像と同じ向きで保存されている (本画像の EXIF orientation を適用する)
+    ImageInfo thumbnail;
+    bool usable = ed->data && ed->size > 0 && probeImage(ed->data, ed->size, thumbnail) &&
+                  thumbnail.format == ImageFormat::JPEG && thumbnail.width >= outWidth &&
+                  thumbnail.height >= outHeight;
+    // 縦横比は 1px の丸め誤差まで許容する
+    usable = usable && std::abs(static_cast<int64_t>(thumbnail.width) * info.height -
+                                static_cast<int64_t>(thumbnail.height) * info.width) <=
+                           std::max(info.width, info.height);
+    SimpleImage output;
+    ImageFormat inputFormat = ImageFormat::JPEG;
+    if (usable) {
+        ImageProcessor processor(ed->data, ed->size, static_cast<float>(outWidth), static_cast<float>(outHeight));
+        if (processor.isValid()) {
+            output = PillowResize::resize(processor.getImage(), SimpleSize(outWidth, outHeight), filter, reducingGap,
+                                          info.orientation);
+            inputFormat = processor.getInputFormat();
+        }
+    }
+    exif_data_unref(ed);
+    if (output.empty()) {
+        return false;
+    }
+
+    result.data = encodeWithinBytes(output, quality, format, inputFormat, maxBytes, encoder, result.quality);
+    if (result.data.empty()) {
+        return false;
+    }
+    result.originalWidth = static_cast<float>(info.width);
+    result.originalHeight = static_cast<float>(info.height);
+    result.width = static_cast<float>(output.cols());
+    result.height = static_cast<float>(output.rows());
+    js_console_log("Using EXIF thumbnail");
+    return true;
+}
+
+// Row-streaming decode -> resize -> encode for JPEG and non-interlaced PNG.
+// Peak memory scales with the image width (plus the output image) instead of
+// the decoded source area. planarYuv keeps YCbCr JPEGs in planes; with
+// keepAlpha, PNGs that may have transparency are left to the full decode.
+static StreamStatus optimizeImageStreaming(const uint8_t* data, size_t size, float width, float height, float quality,
+                                           const std::string& format, PillowResize::FilterType filter,
+                                           float reducingGap, size_t maxBytes, const EncoderOptions& encoder,
+                                           bool planarYuv, bool keepAlpha, OptimizedImage& result)
+{
+    ImageFormat inputFormat = detectImageFormat(data, size);
+    const int orientation = ImageProcessor::getOrientation(reinterpret_cast<const char*>(data), size);
+    if (inputFormat == ImageFormat::JPEG) {
+        if (planarYuv) {
+            StreamStatus status = optimizeJPEGPlanar(data, size, width, height, quality, format, filter, reducingGap,
+                                                     maxBytes, encoder, orientation, result);
+            if (status != StreamStatus::Unsupported) {
+                return status;
+            }
+        }
+    } else if (inputFormat != ImageFormat::PNG) {
+        return StreamStatus::Unsupported;
+    }
+
+    StreamingPipeline pipeline(width, height, quality, format, filter, reducingGap, maxBytes, encoder, inputFormat,
+                               orientation);
+    StreamStatus status = inputFormat == ImageFormat::JPEG ? streamJPEG(data, size, pipeline)
+                                                           : streamPNG(data, size, pipeline, keepAlpha);
+    if (status != StreamStatus::Done) {
+        return status;
+    }
+    return pipeline.finish(result) ? StreamStatus::Done : StreamStatus::Failed;
+}
+
+bool parseFilterName(const std::string& name, PillowResize::FilterType& filter)
+{
+    static const struct {
+        const char* name;
+        PillowResize::FilterType filter;
+    } filters[] = {
+        {"nearest", PillowResize::FilterType::Nearest},
+        {"box", PillowResize::FilterType::Box},
+        {"bilinear", PillowResize::FilterType::Bilinear},
+        {"bicubic", PillowResize::FilterType::Bicubic},
+        {"lanczos", PillowResize::FilterType::Lanczos},
+    };
+    for (const auto& entry : filters)
+    {
+        if (name == entry.name)
+        {
+            filter = entry.filter;
+            return true;
+        }
+    }
+    js_console_log("Supported filters: nearest, box, bilinear, bicubic, lanczos");
+    return false;
+}
+
+bool canPassThrough(const ImageInfo& info, size_t size, float width, float height, const std::string& format,
+                    size_t passthroughBytes)
+{
+    if (format == "none")
+    {
+        return true;
+    }
+    const bool sameFormat = (format == "webp" && info.format == ImageFormat::WEBP) ||
+                            (format == "jpeg" && info.format == ImageFormat::JPEG);
+    if (!sameFormat || passthroughBytes == 0 || size > passthroughBytes || needsOrientation(info.orientation))
+    {
+        return false;
+    }
+    int outWidth, outHeight;
+    return !computeOutputSize(info.width, info.height, width, height, outWidth, outHeight);
+}
+
+// ヘッダーの情報だけで入力をそのまま返す (デコード・エンコードなし)
+static void setPassThrough(const ImageInfo& info, OptimizedImage& result)
+{
+    result.passthrough = true;
+    result.originalWidth = static_cast<float>(info.width);
+    result.originalHeight = static_cast<float>(info.height);
+    result.width = static_cast<float>(info.width);
+    result.height = static_cast<float>(info.height);
+}
+
+bool optimizeImage(const uint8_t* data, size_t size, const OptimizeTarget& target, OptimizedImage& result)
+{
+    // サポートする出力形式を拡張: webp, jpeg, none
+    if (target.format != "webp" && target.format != "jpeg" && target.format != "none")
+    {
+        js_console_log("Supported formats: webp, jpeg, none");
+        return false;
+    }
+
+    // "none" と、そのまま返せる入力はヘッダーだけを読む。向きだけの JPEG は係数のまま変換し、
+    // 小さい出力は EXIF サムネイルから作る
+    const bool lossless = target.losslessOrientation && target.format == "jpeg";
+    if (target.format == "none" || target.passthroughBytes > 0 || lossless || target.useThumbnail)
+    {
+        ImageInfo info;
+        if (!probeImage(data, size, info))
+        {
+            js_console_log("Failed to read image header");
+            return false;
+        }
+        // バイト上限を超える入力はそのまま返さない
+        const size_t passthroughBytes = target.maxBytes > 0 ? std::min(target.passthroughBytes, target.maxBytes)
+                                                            : target.passthroughBytes;
+        if (canPassThrough(info, size, target.width, target.height, target.format, passthroughBytes))
+        {
+            setPassThrough(info, result);
+            return true;
+        }
+        if (lossless && optimizeJPEGLossless(data, size, info, target.width, target.height, target.maxBytes,
+                                             target.encoder, target.keepMetadata, result))
+        {
+            return true;
+        }
+        if (target.useThumbnail &&
+            optimizeJPEGThumbnail(data, size, info, target.width, target.height, target.quality, target.format,
+                                  target.filter, target.reducingGap, target.maxBytes, target.encoder, result))
+        {
+            return true;
+        }
+    }
+
+    // アルファは WebP 出力ではそのまま、JPEG 出力では背景色と合成する
+    const int jpegBackground = target.format == "jpeg" ? target.background : -1;
+    const bool keepAlpha = target.format == "webp" || jpegBackground >= 0;
+
+    // JPEG / PNG は行単位でデコード・リサイズ・エンコードし、元画像全体を展開しない
+    StreamStatus status = optimizeImageStreaming(data, size, target.width, target.height, target.quality,
+                                                 target.format, target.filter, target.reducingGap, target.maxBytes,
+                                                 target.encoder, target.planarYuv, keepAlpha, result);
+    if (status != StreamStatus::Unsupported)
+    {
+        return status == StreamStatus::Done;
+    }
+
+    ImageProcessor processor(data, size, target.width, target.height, keepAlpha);
+
+    if (!processor.isValid())
+    {
+        js_console_log("Failed to load image");
+        return false;
+    }
+
+    result.originalWidth = processor.getOriginalWidth();
+    result.originalHeight = processor.getOriginalHeight();
+
+    // Resize image (Lanczos unless another filter is requested); an image that
+    // needs neither a resize nor an orientation (nor compositing) is encoded as decoded
+    SimpleImage processedImage;
+    const SimpleImage* output = &processor.getImage();
+    if (!processor.isOutputUnchanged(target.width, target.height) ||
+        (output->channels() == 4 && jpegBackground >= 0))
+    {
+        processedImage = processor.resize(target.width, target.height, target.filter, target.reducingGap,
+                                          jpegBackground);
+        if (processedImage.empty())
+        {
+            js_console_log("Failed to resize image");
+            return false;
+        }
+        output = &processedImage;
+    }
+
+    result.data = encodeWithinBytes(*output, target.quality, target.format, processor.getInputFormat(),
+                                    target.maxBytes, target.encoder, result.quality);
+    
+    if (result.data.empty()) {
+        js_console_log("Failed to encode image");
+        return false;
+    }
+
+    result.width = static_cast<float>(output->cols());
+    result.height = static_cast<float>(output->rows());
+    return true;
+}
+
+bool optimizeImageMany(const uint8_t* data, size_t size, const std::vector<OptimizeTarget>& targets,
+                       float cascadeRatio, std::vector<OptimizedImage>& results)
+{
+    bool probeNeeded = false;
+    for (const OptimizeTarget& target : targets)
+    {
+        if (target.format != "webp" && target.format != "jpeg" && target.format != "none")
+        {
+            js_console_log("Supported formats: webp, jpeg, none");
+            return false;
         }
-        else if (height > 0 && width <= 0)
+        probeNeeded = probeNeeded || target.format == "none" || target.passthroughBytes > 0 ||
+                      (target.losslessOrientation && target.format == "jpeg") || target.useThumbnail;
+    }
+
+    // "none" と、そのまま返せるターゲット、向きだけの JPEG、サムネイルで足りるターゲットは
+    // 本画像をデコードせずに済ませる
+    const size_t count = targets.size();
+    results.clear();
+    results.resize(count);
+    std::vector<bool> done(count, false);
+    std::vector<TargetSize> bounds;
+    bool keepAlpha = false;
+    ImageInfo info;
+    if (probeNeeded && !probeImage(data, size, info))
+    {
+        js_console_log("Failed to read image header");
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        const OptimizeTarget& target = targets[i];
+        const size_t passthroughBytes =
+            target.maxBytes > 0 ? std::min(target.passthroughBytes, target.maxBytes) : target.passthroughBytes;
+        if (probeNeeded && canPassThrough(info, size, target.width, target.height, target.format, passthroughBytes))
         {
-            // Only height specified - calculate width to maintain aspect ratio
-            outWidth = static_cast<int>(height * aspectSrc);
-            
-            // Don't upscale if original height is smaller than target height
-            if (originalHeight <= height)
-            {
-                return applyOrientation(m_image.clone());
-            }
+            setPassThrough(info, results[i]);
+            done[i] = true;
+        }
+        else if (probeNeeded && target.losslessOrientation && target.format == "jpeg" &&
+                 optimizeJPEGLossless(data, size, info, target.width, target.height, target.maxBytes, target.encoder,
+                                      target.keepMetadata, results[i]))
+        {
+            done[i] = true;
+        }
+        else if (target.useThumbnail &&
+                 optimizeJPEGThumbnail(data, size, info, target.width, target.height, target.quality, target.format,
+                                       target.filter, target.reducingGap, target.maxBytes, target.encoder, results[i]))
+        {
+            done[i] = true;
         }
         else
         {
-            // Neither specified - use original dimensions
-            outWidth = originalWidth;
-            outHeight = originalHeight;
+            bounds.push_back(TargetSize{target.width, target.height});
+            keepAlpha = keepAlpha || target.format == "webp" || (target.format == "jpeg" && target.background >= 0);
         }
+    }
+    if (bounds.empty())
+    {
+        return true;
+    }
 
-        SimpleImage resizedImage;
-        
-        // Use high-quality Lanczos resampling from pillow-resize
-        resizedImage = PillowResize::resize(m_image, SimpleSize(outWidth, outHeight));
-        
-        if (resizedImage.empty()) {
-            js_console_log("Pillow resize failed");
-            return SimpleImage();
-        }
+    // 全ターゲットを満たす縮小率で一度だけデコードする
+    ImageProcessor processor(data, size, bounds, keepAlpha);
+    if (!processor.isValid())
+    {
+        js_console_log("Failed to load image");
+        return false;
+    }
 
-        return applyOrientation(resizedImage);
+    // RGBA は一度だけ premultiply し、縮小 (カスケードを含む) は premultiplied のまま行う
+    const bool alpha = processor.getImage().channels() == 4;
+    SimpleImage premultiplied;
+    if (alpha)
+    {
+        simple_imgproc::cvtColor(processor.getImage(), premultiplied, simple_imgproc::RGBA2mRGBA);
     }
+    const SimpleImage& decoded = alpha ? premultiplied : processor.getImage();
 
-private:
-    SimpleImage applyOrientation(SimpleImage image)
+    std::vector<int> outWidths(count), outHeights(count);
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        processor.outputSize(targets[i].width, targets[i].height, outWidths[i], outHeights[i]);
+        order[i] = i;
+    }
+    // 大きい出力から順に処理し、後続の縮小元として使えるようにする
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return static_cast<int64_t>(outWidths[a]) * outHeights[a] > static_cast<int64_t>(outWidths[b]) * outHeights[b];
+    });
+
+    // Cascading never upsamples from a smaller output
+    const float ratio = cascadeRatio > 0 ? std::max(cascadeRatio, 1.0f) : 0;
+    std::vector<SimpleImage> resized(count);
+
+    for (size_t index : order)
     {
-        // rotate image if needed
-        switch (m_orientation)
+        if (done[index])
         {
-        case 1:
-            // No rotation
-            break;
-        case 3:
-            // 180 degrees
+            continue;
+        }
+        const OptimizeTarget& target = targets[index];
+        OptimizedImage& result = results[index];
+        result.originalWidth = processor.getOriginalWidth();
+        result.originalHeight = processor.getOriginalHeight();
+
+        // Outputs are kept at the EXIF orientation, so cascading compares display sizes
+        const int outWidth = outWidths[index];
+        const int outHeight = outHeights[index];
+        const SimpleSize displaySize = simple_imgproc::orientedSize(outWidth, outHeight, processor.orientation());
+        const SimpleImage* source = nullptr;
+        if (ratio > 0)
+        {
+            // 十分大きい既存の出力のうち最小のものから縮小する
+            for (const SimpleImage& candidate : resized)
             {
-                SimpleImage rotated;
-                simple_imgproc::rotate(image, rotated, simple_imgproc::ROTATE_180);
-#if HAVE_WASM_SIMD
-                // Use SIMD-optimized copy if available
-                image.create(rotated.rows(), rotated.cols(), rotated.channels());
-                fastMemcpy_SIMD(image.data(), rotated.data(), 
-                               rotated.rows() * rotated.cols() * rotated.channels());
-#else
-                image = rotated;
-#endif
+                if (!candidate.empty() && (!source || candidate.cols() < source->cols()) &&
+                    candidate.cols() >= ratio * displaySize.width && candidate.rows() >= ratio * displaySize.height)
+                {
+                    source = &candidate;
+                }
             }
-            break;
-        case 6:
-            // 90 degrees clockwise
+        }
+
+        if (!source)
+        {
+            // Decoded image: resize and orient in one go
+            resized[index] = PillowResize::resize(decoded, SimpleSize(outWidth, outHeight), target.filter,
+                                                  target.reducingGap, processor.orientation());
+        }
+        else if (source->cols() == displaySize.width && source->rows() == displaySize.height)
+        {
+            resized[index] = source->clone();
+        }
+        else
+        {
+            resized[index] = PillowResize::resize(*source, displaySize, target.filter, target.reducingGap);
+        }
+        if (resized[index].empty())
+        {
+            js_console_log("Failed to resize image");
+            return false;
+        }
+
+        // Premultiplied outputs: straight RGBA for WebP, composited or alpha-dropped RGB for JPEG.
+        // An output without resize, orientation or compositing is the decoded image
+        // itself, so it skips the premultiply round trip.
+        const SimpleImage* output = &resized[index];
+        SimpleImage straight;
+        if (alpha)
+        {
+            const int background = target.format == "jpeg" ? target.background : -1;
+            output = &processor.getImage();
+            if (background >= 0 || !processor.isOutputUnchanged(target.width, target.height))
             {
-                SimpleImage rotated;
-                simple_imgproc::rotate(image, rotated, simple_imgproc::ROTATE_90_CLOCKWISE);
-#if HAVE_WASM_SIMD
-                // Use SIMD-optimized copy if available
-                image.create(rotated.rows(), rotated.cols(), rotated.channels());
-                fastMemcpy_SIMD(image.data(), rotated.data(), 
-                               rotated.rows() * rotated.cols() * rotated.channels());
-#else
-                image = rotated;
-#endif
+                straight = fromPremultiplied(resized[index], background);
+                output = &straight;
             }
-            break;
-        case 8:
-            // 90 degrees counter-clockwise
+            if (output->channels() == 4 && target.format == "jpeg")
             {
-                SimpleImage rotated;
-                simple_imgproc::rotate(image, rotated, simple_imgproc::ROTATE_90_COUNTERCLOCKWISE);
-#if HAVE_WASM_SIMD
-                // Use SIMD-optimized copy if available
-                image.create(rotated.rows(), rotated.cols(), rotated.channels());
-                fastMemcpy_SIMD(image.data(), rotated.data(), 
-                               rotated.rows() * rotated.cols() * rotated.channels());
-#else
-                image = rotated;
-#endif
+                SimpleImage rgb;
+                simple_imgproc::cvtColor(*output, rgb, simple_imgproc::RGBA2RGB);
+                straight = std::move(rgb);
+                output = &straight;
             }
-            break;
+        }
+        const SimpleImage& processedImage = *output;
+        result.data = encodeWithinBytes(processedImage, target.quality, target.format, processor.getInputFormat(),
+                                        target.maxBytes, target.encoder, result.quality);
+        if (result.data.empty())
+        {
+            js_console_log("Failed to encode image");
+            return false;
         }
 
-        return image;
+        result.width = static_cast<float>(processedImage.cols());
+        result.height = static_cast<float>(processedImage.rows());
+    }
+    return true;
+}
+
+#ifdef __EMSCRIPTEN__
+// Keeps the encoder outputs alive while JS copies them out of the views
+// returned by optimize() / optimizeMany(); released by releaseResult() or
+// the next call
+class ResultHolder
+{
+private:
+    std::vector<EncodedBuffer> m_buffers;
+
+public:
+    const uint8_t *hold(EncodedBuffer buffer)
+    {
+        m_buffers.push_back(std::move(buffer));
+        return m_buffers.back().data();
+    }
+
+    void release()
+    {
+        m_buffers.clear();
+    }
+};
+
+ResultHolder resultHolder;
+
+val createResult(size_t size, const uint8_t *ptr, const OptimizedImage &optimized)
+{
+    val result = val::object();
+    result.set("data", val(typed_memory_view(size, ptr)));
+    result.set("originalWidth", optimized.originalWidth);
+    result.set("originalHeight", optimized.originalHeight);
+    result.set("width", optimized.width);
+    result.set("height", optimized.height);
+    if (optimized.quality >= 0)
+    {
+        result.set("quality", optimized.quality);
     }
+    return result;
+}
+
+void releaseResult()
+{
+    resultHolder.release();
+}
+
+// Input region in the wasm heap. JS writes the image bytes into the view
+// returned by getInputBuffer() and calls optimizeInput() with the length, so
+// the input is copied once and the allocation is reused across calls.
+class InputBuffer
+{
+private:
+    uint8_t *m_ptr;
+    size_t m_capacity;
 
 public:
-    float getOriginalWidth() const { return m_originalWidth; }
-    float getOriginalHeight() const { return m_originalHeight; }
-    SimpleImage getImage() const { return m_image; }
-    ImageFormat getInputFormat() const { return m_inputFormat; }
+    InputBuffer() : m_ptr(nullptr), m_capacity(0) {}
+
+    uint8_t *reserve(size_t size)
+    {
+        if (size > m_capacity)
+        {
+            // 内容は保持しないので realloc ではなく確保し直す
+            std::free(m_ptr);
+            m_capacity = std::max(size, m_capacity + m_capacity / 2);
+            m_ptr = static_cast<uint8_t *>(std::malloc(m_capacity));
+            if (!m_ptr)
+            {
+                m_capacity = 0;
+            }
+        }
+        return m_ptr;
+    }
+
+    const uint8_t *data() const { return m_ptr; }
+    size_t capacity() const { return m_capacity; }
 };
 
-// 前方宣言
-std::vector<uint8_t> encodeJPEG(const SimpleImage& image, int quality);
-std::vector<uint8_t> encodeWEBP(const SimpleImage& image, float quality, bool lossless);
+InputBuffer inputBuffer;
 
-val optimize(std::string imgData, float width, float height, float quality, std::string format)
+val getInputBuffer(size_t size)
 {
-    // サポートする出力形式を拡張: webp, jpeg, none
-    if (format != "webp" && format != "jpeg" && format != "none")
+    uint8_t *ptr = inputBuffer.reserve(size);
+    if (!ptr)
     {
-        js_console_log("Supported formats: webp, jpeg, none");
         return val::null();
     }
+    return val(typed_memory_view(size, ptr));
+}
+
+static float numberOr(const val &object, const char *key, float fallback)
+{
+    val value = object[key];
+    return value.isUndefined() || value.isNull() ? fallback : value.as<float>();
+}
+
+static int intOr(const val &object, const char *key, int fallback)
+{
+    return static_cast<int>(numberOr(object, key, static_cast<float>(fallback)));
+}
 
-    ImageProcessor processor(imgData);
+static bool boolOr(const val &object, const char *key, bool fallback)
+{
+    val value = object[key];
+    return value.isUndefined() || value.isNull() ? fallback : value.as<bool>();
+}
 
-    if (!processor.isValid())
+// {preset, method, pass, segments, threadLevel, sharpYuv, nearLossless, losslessLevel,
+//  progressive, optimizeCoding, subsampling, restartInterval, dctMethod}; the
+// preset ("default" when absent) is applied first, the other fields override it
+static bool parseEncoderOptions(const val &object, EncoderOptions &options)
+{
+    options = EncoderOptions();
+    if (object.isUndefined() || object.isNull())
     {
-        js_console_log("Failed to load image");
-        return val::null();
+        return true;
+    }
+    val preset = object["preset"];
+    if (!preset.isUndefined() && !preset.isNull() && !parseEncoderPreset(preset.as<std::string>(), options))
+    {
+        return false;
     }
 
-    // "none" format: 元画像をそのまま返す（サイズ変更なし）
-    if (format == "none")
+    options.method = intOr(object, "method", options.method);
+    options.pass = intOr(object, "pass", options.pass);
+    options.segments = intOr(object, "segments", options.segments);
+    options.threadLevel = intOr(object, "threadLevel", options.threadLevel);
+    options.sharpYuv = boolOr(object, "sharpYuv", options.sharpYuv);
+    options.nearLossless = intOr(object, "nearLossless", options.nearLossless);
+    options.losslessLevel = intOr(object, "losslessLevel", options.losslessLevel);
+    options.progressive = boolOr(object, "progressive", options.progressive);
+    options.optimizeCoding = boolOr(object, "optimizeCoding", options.optimizeCoding);
+    options.restartInterval = intOr(object, "restartInterval", options.restartInterval);
+
+    val subsampling = object["subsampling"];
+    if (!subsampling.isUndefined() && !subsampling.isNull())
+    {
+        const std::string name = subsampling.as<std::string>();
+        if (name == "4:2:0")
+        {
+            options.subsampling = ChromaSubsampling::YUV420;
+        }
+        else if (name == "4:2:2")
+        {
+            options.subsampling = ChromaSubsampling::YUV422;
+        }
+        else if (name == "4:4:4")
+        {
+            options.subsampling = ChromaSubsampling::YUV444;
+        }
+        else
+        {
+            js_console_log("Supported subsampling: 4:2:0, 4:2:2, 4:4:4");
+            return false;
+        }
+    }
+    val dctMethod = object["dctMethod"];
+    if (!dctMethod.isUndefined() && !dctMethod.isNull())
+    {
+        const std::string name = dctMethod.as<std::string>();
+        if (name == "islow")
+        {
+            options.dctMethod = DctMethod::IntegerSlow;
+        }
+        else if (name == "ifast")
+        {
+            options.dctMethod = DctMethod::IntegerFast;
+        }
+        else if (name == "float")
+        {
+            options.dctMethod = DctMethod::Float;
+        }
+        else
+        {
+            js_console_log("Supported DCT methods: islow, ifast, float");
+            return false;
+        }
+    }
+    return true;
+}
+
+// "#rgb" / "#rrggbb" to 0xRRGGBB; undefined / null gives -1 (no background)
+static bool parseBackground(const val &value, int &background)
+{
+    background = -1;
+    if (value.isUndefined() || value.isNull())
+    {
+        return true;
+    }
+    const std::string color = value.as<std::string>();
+    const size_t digits = color.size() - 1;
+    if (color.empty() || color[0] != '#' || (digits != 3 && digits != 6) ||
+        color.find_first_not_of("0123456789abcdefABCDEF", 1) != std::string::npos)
     {
-        SimpleImage originalImage = processor.getImage();
-        return createResult(imgData.size(),
-                            reinterpret_cast<const uint8_t *>(imgData.c_str()),
-                            processor.getOriginalWidth(),
-                            processor.getOriginalHeight(),
-                            static_cast<float>(originalImage.cols()),
-                            static_cast<float>(originalImage.rows()));
+        js_console_log("Background must be a #rgb or #rrggbb color");
+        return false;
     }
+    const int rgb = static_cast<int>(std::stoul(color.substr(1), nullptr, 16));
+    // #rgb は各桁を 2 回繰り返す (#f80 -> #ff8800)
+    background = digits == 6 ? rgb
+                             : ((rgb & 0xf00) << 12 | (rgb & 0xf00) << 8 | (rgb & 0xf0) << 8 | (rgb & 0xf0) << 4 |
+                                (rgb & 0xf) << 4 | (rgb & 0xf));
+    return true;
+}
 
-    // Resize image using Lanczos algorithm
-    SimpleImage processedImage = processor.resize(width, height);
+// {width, height, quality, format, filter, reducingGap, passthroughBytes, maxBytes, encoder, planarYuv, background,
+//  losslessOrientation, keepMetadata, useThumbnail}; missing fields keep the OptimizeTarget defaults
+static bool parseTarget(const val &item, OptimizeTarget &target)
+{
+    if (item.isUndefined() || item.isNull())
+    {
+        return true;
+    }
+    target.width = numberOr(item, "width", 0);
+    target.height = numberOr(item, "height", 0);
+    target.quality = numberOr(item, "quality", 100);
+    target.reducingGap = numberOr(item, "reducingGap", 0);
+    target.passthroughBytes = static_cast<size_t>(numberOr(item, "passthroughBytes", 0));
+    target.maxBytes = static_cast<size_t>(numberOr(item, "maxBytes", 0));
+    target.planarYuv = boolOr(item, "planarYuv", false);
+    target.losslessOrientation = boolOr(item, "losslessOrientation", false);
+    target.keepMetadata = boolOr(item, "keepMetadata", false);
+    target.useThumbnail = boolOr(item, "useThumbnail", false);
+    val format = item["format"];
+    if (!format.isUndefined() && !format.isNull())
+    {
+        target.format = format.as<std::string>();
+    }
+    val filter = item["filter"];
+    if (!filter.isUndefined() && !filter.isNull() &&
+        !parseFilterName(filter.as<std::string>(), target.filter))
+    {
+        return false;
+    }
+    return parseEncoderOptions(item["encoder"], target.encoder) &&
+           parseBackground(item["background"], target.background);
+}
 
-    if (processedImage.empty())
+// options: see parseTarget(); input in the buffer from getInputBuffer()
+val optimizeInput(size_t size, val options)
+{
+    OptimizeTarget target;
+    if (!parseTarget(options, target))
     {
-        js_console_log("Failed to resize image");
         return val::null();
     }
 
-    // 入力形式に応じて圧縮設定を決定
-    ImageFormat inputFormat = processor.getInputFormat();
-    bool shouldUseLossless = (inputFormat == ImageFormat::PNG || inputFormat == ImageFormat::WEBP);
-    
-    std::vector<uint8_t> encodedData;
-    
-    if (format == "webp") {
-        // WEBP出力：入力形式に応じて可逆/非可逆を選択
-        encodedData = encodeWEBP(processedImage, quality, shouldUseLossless);
-        
-        if (shouldUseLossless) {
-            js_console_log("Using lossless WebP compression for PNG/WebP input");
-        }
-    } else if (format == "jpeg") {
-        // JPEG出力：常に非可逆圧縮
-        encodedData = encodeJPEG(processedImage, static_cast<int>(quality));
-        js_console_log("Using JPEG compression");
+    if (!inputBuffer.data() || size > inputBuffer.capacity())
+    {
+        js_console_log("Input buffer is smaller than the given size");
+        return val::null();
     }
-    
-    if (encodedData.empty()) {
-        js_console_log("Failed to encode image");
+
+    resultHolder.release();
+    const uint8_t *data = inputBuffer.data();
+    OptimizedImage optimized;
+    if (!optimizeImage(data, size, target, optimized))
+    {
         return val::null();
     }
 
-    val result = createResult(encodedData.size(), encodedData.data(),
-                              processor.getOriginalWidth(),
-                              processor.getOriginalHeight(),
-                              static_cast<float>(processedImage.cols()),
-                              static_cast<float>(processedImage.rows()));
+    // "none" / passthrough: 入力バッファは次の getInputBuffer() まで有効なので、そのまま参照する
+    if (optimized.passthrough)
+    {
+        return createResult(size, data, optimized);
+    }
 
-    return result;
+    const size_t resultSize = optimized.data.size();
+    return createResult(resultSize, resultHolder.hold(std::move(optimized.data)), optimized);
 }
 
-// JPEG エンコード関数
-std::vector<uint8_t> encodeJPEG(const SimpleImage& image, int quality) {
-    std::vector<uint8_t> result;
-    
-    // JPEG圧縮用の構造体を初期化
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    
-    // メモリ出力の設定
-    unsigned char* outbuffer = nullptr;
-    unsigned long outsize = 0;
-    jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
-    
-    // 画像サイズと形式の設定
-    cinfo.image_width = image.cols();
-    cinfo.image_height = image.rows();
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-    
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
-    
-    // 圧縮開始
-    jpeg_start_compress(&cinfo, TRUE);
-    
-    // BGR to RGB 変換とエンコード
-    SimpleImage rgb_image;
+// options: see parseTarget()
+val optimize(std::string imgData, val options)
+{
+    OptimizeTarget target;
+    if (!parseTarget(options, target))
+    {
+        return val::null();
+    }
+
+    resultHolder.release();
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(imgData.c_str());
+    OptimizedImage optimized;
+
+    if (!optimizeImage(data, imgData.size(), target, optimized))
+    {
+        return val::null();
+    }
+
+    // "none" / passthrough は元画像をそのまま返す (入力文字列は戻り値より先に破棄されるため複製する)
+    if (optimized.passthrough)
+    {
+        uint8_t *copy = static_cast<uint8_t *>(std::malloc(imgData.size()));
+        if (!copy)
+        {
+            return val::null();
+        }
 #if HAVE_WASM_SIMD
-    convertBGRtoRGB_SIMD(image, rgb_image);
+        fastMemcpy_SIMD(copy, data, imgData.size());
 #else
-    simple_imgproc::cvtColor(image, rgb_image, simple_imgproc::BGR2RGB);
+        std::memcpy(copy, data, imgData.size());
 #endif
-    
-    while (cinfo.next_scanline < cinfo.image_height) {
-        JSAMPROW row_pointer = rgb_image.ptr<JSAMPLE>(cinfo.next_scanline);
-        jpeg_write_scanlines(&cinfo, &row_pointer, 1);
+        optimized.data = EncodedBuffer(copy, imgData.size());
     }
-    
-    jpeg_finish_compress(&cinfo);
-    
-    // 結果をvectorにコピー
-    result.assign(outbuffer, outbuffer + outsize);
-    
-    // クリーンアップ
-    if (outbuffer) {
-        free(outbuffer);
+
+    const size_t resultSize = optimized.data.size();
+    return createResult(resultSize, resultHolder.hold(std::move(optimized.data)), optimized);
+}
+
+// {format, width, height, channels, bitDepth, hasAlpha, progressive, orientation}; null when unknown
+val createProbeResult(const uint8_t *data, size_t size)
+{
+    ImageInfo info;
+    if (!probeImage(data, size, info))
+    {
+        return val::null();
     }
-    jpeg_destroy_compress(&cinfo);
-    
+    val result = val::object();
+    result.set("format", std::string(info.format == ImageFormat::JPEG ? "jpeg"
+                                     : info.format == ImageFormat::PNG ? "png"
+                                                                       : "webp"));
+    result.set("width", info.width);
+    result.set("height", info.height);
+    result.set("channels", info.channels);
+    result.set("bitDepth", info.bitDepth);
+    result.set("hasAlpha", info.hasAlpha);
+    result.set("progressive", info.progressive);
+    result.set("orientation", info.orientation);
     return result;
 }
 
-// WEBP エンコード関数（可逆・非可逆対応）
-std::vector<uint8_t> encodeWEBP(const SimpleImage& image, float quality, bool lossless) {
-    std::vector<uint8_t> result;
-    
-    // BGR to RGB 変換
-    SimpleImage rgb_image;
-#if HAVE_WASM_SIMD
-    convertBGRtoRGB_SIMD(image, rgb_image);
-#else
-    simple_imgproc::cvtColor(image, rgb_image, simple_imgproc::BGR2RGB);
-#endif
-    
-    uint8_t* webpData = nullptr;
-    size_t webpSize = 0;
-    
-    if (lossless) {
-        // 可逆圧縮
-        webpSize = WebPEncodeLosslessRGB(rgb_image.data(), rgb_image.cols(), rgb_image.rows(), 
-                                       rgb_image.cols() * 3, &webpData);
-    } else {
-        // 非可逆圧縮（既存の実装）
-        webpSize = WebPEncodeRGB(rgb_image.data(), rgb_image.cols(), rgb_image.rows(), 
-                                rgb_image.cols() * 3, quality, &webpData);
+// ヘッダーだけを読み、画素はデコードしない
+val probe(std::string imgData)
+{
+    return createProbeResult(reinterpret_cast<const uint8_t *>(imgData.c_str()), imgData.size());
+}
+
+// Probe the first `size` bytes written to getInputBuffer()
+val probeInput(size_t size)
+{
+    if (!inputBuffer.data() || size > inputBuffer.capacity())
+    {
+        js_console_log("Input buffer is smaller than the given size");
+        return val::null();
     }
-    
-    if (webpSize > 0 && webpData) {
-        result.assign(webpData, webpData + webpSize);
-        WebPFree(webpData);
+    return createProbeResult(inputBuffer.data(), size);
+}
+
+// targets: [options of parseTarget() (planarYuv does not apply)], input in the buffer from getInputBuffer()
+val optimizeMany(size_t size, val targets, float cascadeRatio)
+{
+    if (!inputBuffer.data() || size > inputBuffer.capacity())
+    {
+        js_console_log("Input buffer is smaller than the given size");
+        return val::null();
     }
-    
-    return result;
+
+    resultHolder.release();
+    std::vector<OptimizeTarget> list;
+    const unsigned length = targets["length"].as<unsigned>();
+    for (unsigned i = 0; i < length; ++i)
+    {
+        OptimizeTarget target;
+        if (!parseTarget(targets[i], target))
+        {
+            return val::null();
+        }
+        list.push_back(target);
+    }
+
+    const uint8_t *data = inputBuffer.data();
+    std::vector<OptimizedImage> optimized;
+    if (!optimizeImageMany(data, size, list, cascadeRatio, optimized))
+    {
+        resultHolder.release();
+        return val::null();
+    }
+
+    val results = val::array();
+    for (unsigned i = 0; i < optimized.size(); ++i)
+    {
+        OptimizedImage &item = optimized[i];
+        if (item.passthrough)
+        {
+            results.set(i, createResult(size, data, item));
+            continue;
+        }
+        const size_t resultSize = item.data.size();
+        results.set(i, createResult(resultSize, resultHolder.hold(std::move(item.data)), item));
+    }
+    return results;
 }
 
 EMSCRIPTEN_BINDINGS(my_module)
 {
     function("optimize", &optimize);
+    function("getInputBuffer", &getInputBuffer);
+    function("optimizeInput", &optimizeInput);
+    function("optimizeMany", &optimizeMany);
+    function("probe", &probe);
+    function("probeInput", &probeInput);
     function("releaseResult", &releaseResult);
 }
+#endif
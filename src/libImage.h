@@ -0,0 +1,279 @@
+#ifndef LIBIMAGE_H
+#define LIBIMAGE_H
+
+// Thin C++ API of the image core (decode -> resize -> orient -> encode).
+// The embind bindings in libImage.cpp are a wrapper around this API, and
+// the native build (make native / make bench) links against it directly.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pillow_resize.hpp"
+#include "simple_image.h"
+
+// Enum for image formats
+enum class ImageFormat {
+    JPEG,
+    PNG,
+    WEBP,
+    UNKNOWN
+};
+
+// File format detection function
+ImageFormat detectImageFormat(const uint8_t* data, size_t size);
+
+// Header-only description of an encoded image
+struct ImageInfo {
+    ImageFormat format = ImageFormat::UNKNOWN;
+    int width = 0;              // Stored size; orientations 5-8 swap it for display
+    int height = 0;
+    int channels = 0;           // Encoded channels (gray 1, gray+alpha 2, color 3, with alpha / CMYK 4)
+    int bitDepth = 0;           // Bits per sample as stored (PNG palette: index bits)
+    bool hasAlpha = false;
+    bool progressive = false;   // Progressive JPEG or interlaced (Adam7) PNG
+    int orientation = 1;        // EXIF orientation
+};
+
+// Reads only the headers (JPEG SOF, PNG IHDR, WebP VP8 / VP8L / VP8X); no pixels are decoded.
+// Returns false for unknown formats and truncated headers.
+bool probeImage(const uint8_t* data, size_t size, ImageInfo& info);
+
+// Fit the source dimensions into the requested bounds while keeping the aspect ratio.
+// Returns false when no resize is needed (no bounds given or the source already fits).
+bool computeOutputSize(int srcWidth, int srcHeight, float width, float height, int &outWidth, int &outHeight);
+
+// Orientations that swap width and height when applied
+bool isTransposedOrientation(int orientation);
+
+// Requested output bounds of the stored image, before the EXIF orientation (0 = unconstrained)
+struct TargetSize {
+    float width = 0;
+    float height = 0;
+};
+
+class ImageProcessor
+{
+private:
+    SimpleImage m_image;
+    float m_originalWidth;
+    float m_originalHeight;
+    int m_orientation;
+    ImageFormat m_inputFormat;
+
+    SimpleImage decodeJPEG(const uint8_t* data, size_t size, const std::vector<TargetSize>& targets);
+    SimpleImage decodeWEBP(const uint8_t* data, size_t size, bool keepAlpha);
+    SimpleImage decodePNG(const uint8_t* data, size_t size, bool keepAlpha);
+
+public:
+    // Decodes the image to RGB, or to 1-channel GRAY for grayscale JPEG / PNG.
+    // With keepAlpha, PNG / WebP images with transparent pixels decode to
+    // (straight) RGBA; fully opaque ones still take the RGB / GRAY path.
+    // A non-zero target size allows reduced-size decoding (JPEG shrink-on-load)
+    ImageProcessor(const uint8_t* data, size_t size, float targetWidth = 0, float targetHeight = 0,
+                   bool keepAlpha = false);
+
+    // Decodes at a reduced size that still covers every target
+    ImageProcessor(const uint8_t* data, size_t size, const std::vector<TargetSize>& targets, bool keepAlpha = false);
+
+    // EXIF orientation (1-8) from JPEG APP1, PNG eXIf or WebP EXIF; 1 when absent.
+    // Scans only IFD0 of the TIFF structure, without allocating
+    static int getOrientation(const char *data, size_t size);
+
+    // Target size in stored (pre-orientation) pixel space; the bounds apply to the stored image
+    void targetSize(int srcWidth, int srcHeight, float width, float height, int &outWidth, int &outHeight, bool &needResize) const;
+
+    // Output size in stored pixel space (original size when no resize is needed)
+    void outputSize(float width, float height, int &outWidth, int &outHeight) const;
+
+    bool isValid() const { return !m_image.empty(); }
+
+    // Resize (Lanczos by default) and apply the EXIF orientation.
+    // reducingGap >= 1 box-reduces large downscales first (PillowResize::resize).
+    // RGBA is resampled with premultiplied alpha and returned as RGBA, or as
+    // RGB composited onto background (0xRRGGBB) when it is not negative.
+    SimpleImage resize(float width, float height,
+                       PillowResize::FilterType filter = PillowResize::FilterType::Lanczos,
+                       float reducingGap = 0, int background = -1);
+
+    // resize() would return the decoded image unchanged (no resize, no orientation)
+    bool isOutputUnchanged(float width, float height) const;
+
+    int orientation() const { return m_orientation; }
+
+    float getOriginalWidth() const { return m_originalWidth; }
+    float getOriginalHeight() const { return m_originalHeight; }
+    const SimpleImage& getImage() const { return m_image; }
+    ImageFormat getInputFormat() const { return m_inputFormat; }
+};
+
+// Encoder output. Owns the buffer allocated by libjpeg / libwebp (released with
+// the matching free function), so the bytes can be handed to JS as a view
+// without being copied into a std::vector first.
+class EncodedBuffer
+{
+private:
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    void (*m_release)(void*) = nullptr;
+
+public:
+    EncodedBuffer() = default;
+    EncodedBuffer(uint8_t* data, size_t size, void (*release)(void*) = std::free)
+        : m_data(data), m_size(size), m_release(release) {}
+    ~EncodedBuffer() { reset(); }
+
+    EncodedBuffer(const EncodedBuffer&) = delete;
+    EncodedBuffer& operator=(const EncodedBuffer&) = delete;
+    EncodedBuffer(EncodedBuffer&& other) noexcept
+        : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)),
+          m_release(other.m_release) {}
+    EncodedBuffer& operator=(EncodedBuffer&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+            m_release = other.m_release;
+        }
+        return *this;
+    }
+
+    void reset()
+    {
+        if (m_data && m_release) {
+            m_release(m_data);
+        }
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+};
+
+enum class ChromaSubsampling {
+    YUV420,
+    YUV422,
+    YUV444
+};
+
+enum class DctMethod {
+    IntegerSlow,    // JDCT_ISLOW (accurate)
+    IntegerFast,    // JDCT_IFAST
+    Float           // JDCT_FLOAT
+};
+
+// Encoder speed / effort settings (WebPConfig and libjpeg compress parameters).
+// The defaults reproduce the simple calls used before (WebPEncodeRGB,
+// WebPEncodeLosslessRGB, jpeg_set_quality).
+struct EncoderOptions {
+    // WebP
+    int method = 4;             // 0 (fastest) - 6 (smallest output)
+    int pass = 1;               // Entropy analysis passes (1-10)
+    int segments = 4;           // Segments (1-4)
+    int threadLevel = 0;        // Non-zero: multi-threaded encode when libwebp is built with WEBP_USE_THREAD
+    bool sharpYuv = false;      // Sharper, slower RGB -> YUV conversion
+    int nearLossless = 100;     // Lossless preprocessing (0 = strongest, 100 = off)
+    int losslessLevel = -1;     // Lossless effort 0-9 (WebPConfigLosslessPreset); -1 uses method at quality 70
+    // JPEG
+    bool progressive = false;
+    bool optimizeCoding = false; // Optimized Huffman tables
+    ChromaSubsampling subsampling = ChromaSubsampling::YUV420;
+    int restartInterval = 0;    // MCUs between restart markers (0 = none)
+    DctMethod dctMethod = DctMethod::IntegerSlow;
+};
+
+// Presets: "default" (the values above), "fast" for interactive uploads and
+// "max" for offline batch work. Every field is set.
+bool parseEncoderPreset(const std::string& name, EncoderOptions& options);
+
+// Encoders take 3-channel images in the channel order given by their PixelFormat
+// (RGB as produced by ImageProcessor, BGR is accepted without a copy) or
+// 1-channel gray, written as a grayscale JPEG / a WebP with neutral chroma.
+// encodeWEBP also takes straight RGBA and keeps the alpha.
+EncodedBuffer encodeJPEG(const SimpleImage& image, int quality, const EncoderOptions& options = EncoderOptions());
+EncodedBuffer encodeWEBP(const SimpleImage& image, float quality, bool lossless,
+                         const EncoderOptions& options = EncoderOptions());
+
+// Lossless JPEG orientation (jpegtran style): the DCT blocks are rearranged
+// and their coefficients transposed / negated, nothing is decoded or
+// requantized. The EXIF orientation of the output is 1. keepMetadata copies
+// the APPn / COM markers, otherwise only an ICC profile is kept. Of options,
+// progressive and optimizeCoding apply (progressive input stays progressive).
+// Empty when the transform cannot be exact: an orientation that mirrors an
+// axis needs the image size on that axis to be a multiple of the MCU size,
+// since partial edge blocks cannot move to the other side.
+EncodedBuffer transformJPEG(const uint8_t* data, size_t size, int orientation, bool keepMetadata,
+                            const EncoderOptions& options = EncoderOptions());
+
+struct OptimizedImage {
+    EncodedBuffer data;         // Encoded output, empty when passthrough is set
+    bool passthrough = false;   // The input bytes are the output ("none" format or passthroughBytes)
+    float quality = -1;         // Encoder quality of the output (-1 for passthrough)
+    float originalWidth = 0;
+    float originalHeight = 0;
+    float width = 0;
+    float height = 0;
+};
+
+// Filter names accepted by the bindings: nearest, box, bilinear, bicubic, lanczos
+bool parseFilterName(const std::string& name, PillowResize::FilterType& filter);
+
+// The input can be returned as is: it already has the requested format
+// ("none" always matches), fits the bounds without resizing, needs no EXIF
+// orientation and is at most passthroughBytes long (0 disables the rule)
+bool canPassThrough(const ImageInfo& info, size_t size, float width, float height, const std::string& format,
+                    size_t passthroughBytes);
+
+struct OptimizeTarget {
+    float width = 0;
+    float height = 0;
+    float quality = 100;
+    std::string format = "webp";
+    PillowResize::FilterType filter = PillowResize::FilterType::Lanczos;
+    float reducingGap = 0;
+    size_t passthroughBytes = 0;
+    size_t maxBytes = 0;
+    EncoderOptions encoder;
+    int background = -1;        // 0xRRGGBB behind transparent pixels for jpeg output (-1: alpha dropped)
+    bool losslessOrientation = false; // Orientation-only jpeg output through transformJPEG
+    bool keepMetadata = false;  // APPn / COM markers kept by the lossless orientation
+    bool useThumbnail = false;  // Resize the EXIF thumbnail when the output fits inside it
+    bool planarYuv = false;     // Y / Cb / Cr planes for YCbCr JPEG input (optimizeImage only)
+};
+
+// Full pipeline behind the optimize() binding for one target. format is "webp", "jpeg" or "none".
+// reducingGap below 1 disables the box prefilter for large downscales.
+// "none" and inputs that pass canPassThrough() only read the headers.
+// maxBytes > 0 resizes once and searches the encoder quality (at most the
+// given one) for the highest that fits; result.quality reports it.
+// planarYuv keeps YCbCr JPEG input in Y / Cb / Cr planes through resize and
+// encode (chroma resampled at chroma resolution, no RGB conversion); other
+// inputs take the RGB path.
+// Transparent PNG / WebP input keeps its alpha for webp output. For jpeg
+// output it is composited onto background (0xRRGGBB); a negative background
+// drops the alpha as decoded.
+// losslessOrientation writes a JPEG that only needs its EXIF orientation
+// (jpeg output, no resize) with transformJPEG instead of a re-encode;
+// quality does not apply there and result.quality stays -1. It falls back
+// to the re-encode when the transform is not exact or the output exceeds maxBytes.
+// useThumbnail resizes a JPEG's embedded EXIF thumbnail instead of decoding the
+// full image when the output fits inside it and the aspect ratios match;
+// otherwise (no thumbnail, too small, mismatched) the full image is used.
+bool optimizeImage(const uint8_t* data, size_t size, const OptimizeTarget& target, OptimizedImage& result);
+
+// Decodes once and produces every target (results are in target order).
+// Targets are resized from the largest to the smallest output; a target
+// starts from an earlier, larger output instead of the decoded image when
+// that output is at least cascadeRatio times the target in both dimensions
+// (0 always resizes from the decoded image). planarYuv does not apply: the
+// shared decode is RGB.
+bool optimizeImageMany(const uint8_t* data, size_t size, const std::vector<OptimizeTarget>& targets,
+                       float cascadeRatio, std::vector<OptimizedImage>& results);
+
+#endif // LIBIMAGE_H
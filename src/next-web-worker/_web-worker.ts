@@ -1,6 +1,15 @@
 import { initWorker } from "worker-lib";
-import { _optimizeImage, _optimizeImageExt } from "../lib/optimizeImage.js";
-import type { OptimizeParams } from "../types/index.js";
+import {
+  _optimizeImage,
+  _optimizeImageExt,
+  _optimizeImageMany,
+  _probeImage,
+} from "../lib/optimizeImage.js";
+import type {
+  OptimizeManyParams,
+  OptimizeParams,
+  ProbeParams,
+} from "../types/index.js";
 
 const libImage = import("../esm/libImage.js").then((m) => m.default({}));
 
@@ -9,6 +18,10 @@ const map = initWorker({
     _optimizeImage({ ...params, libImage }),
   optimizeImageExt: async (params: OptimizeParams) =>
     _optimizeImageExt({ ...params, libImage }),
+  optimizeImageMany: async (params: OptimizeManyParams) =>
+    _optimizeImageMany({ ...params, libImage }),
+  probeImage: async (params: ProbeParams) =>
+    _probeImage({ ...params, libImage }),
   launch: () => libImage,
 });
 
@@ -1,7 +1,27 @@
 import { createWorker } from "worker-lib";
 import type { WorkerType } from "./_web-worker.js";
-import type { OptimizeParams, OptimizeResult } from "../types/index.js";
-export type { OptimizeParams, OptimizeResult };
+import type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+} from "../types/index.js";
+export type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+};
 
 const { execute, setLimit, close, waitAll, waitReady, launchWorker } =
   createWorker<WorkerType>(
@@ -15,4 +35,10 @@ export const optimizeImage = async (params: OptimizeParams) =>
 export const optimizeImageExt = async (params: OptimizeParams) =>
   execute("optimizeImageExt", params);
 
+export const optimizeImageMany = async (params: OptimizeManyParams) =>
+  execute("optimizeImageMany", params);
+
+export const probeImage = async (params: ProbeParams) =>
+  execute("probeImage", params);
+
 export { setLimit, close, waitAll, waitReady, launchWorker };
@@ -1,8 +1,35 @@
 import LibImage from "../cjs/libImage.js";
-import { _optimizeImage, _optimizeImageExt } from "../lib/optimizeImage.js";
+import {
+  _optimizeImage,
+  _optimizeImageExt,
+  _optimizeImageMany,
+  _probeImage,
+} from "../lib/optimizeImage.js";
 import { getWasmConfig, setWasmUrl, setWasmBinary, resetWasmConfig } from "../types/index.js";
-import type { OptimizeParams, OptimizeResult, WasmConfig } from "../types/index.js";
-export type { OptimizeParams, OptimizeResult, WasmConfig };
+import type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+  WasmConfig,
+} from "../types/index.js";
+export type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+  WasmConfig,
+};
 export { setWasmUrl, setWasmBinary, resetWasmConfig };
 
 const getLibImage = async () => {
@@ -34,6 +61,12 @@ export const optimizeImage = async (params: OptimizeParams) =>
 export const optimizeImageExt = async (params: OptimizeParams) =>
   _optimizeImageExt({ ...params, libImage: getLibImage() });
 
+export const optimizeImageMany = async (params: OptimizeManyParams) =>
+  _optimizeImageMany({ ...params, libImage: getLibImage() });
+
+export const probeImage = async (params: ProbeParams) =>
+  _probeImage({ ...params, libImage: getLibImage() });
+
 export const setLimit = (_limit: number): void => {};
 export const close = () => {};
 export const waitAll = () => Promise.resolve();
@@ -1,9 +1,16 @@
 import { initWorker } from "worker-lib/node";
-import { optimizeImage, optimizeImageExt } from "./";
+import {
+  optimizeImage,
+  optimizeImageExt,
+  optimizeImageMany,
+  probeImage,
+} from "./";
 
 const map = initWorker({
   optimizeImage,
   optimizeImageExt,
+  optimizeImageMany,
+  probeImage,
 });
 
 export type WorkerType = typeof map;
@@ -2,8 +2,28 @@ import path from "node:path";
 import { Worker } from "node:worker_threads";
 import { createWorker } from "worker-lib/node";
 import type { WorkerType } from "./_node-worker.js";
-import type { OptimizeParams, OptimizeResult } from "../types/index.js";
-export type { OptimizeParams, OptimizeResult };
+import type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+} from "../types/index.js";
+export type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+};
 
 const { execute, waitAll, waitReady, close, setLimit, launchWorker } =
   createWorker<WorkerType>(() => {
@@ -17,4 +37,10 @@ export const optimizeImage = async (params: OptimizeParams) =>
 export const optimizeImageExt = async (params: OptimizeParams) =>
   execute("optimizeImageExt", params);
 
+export const optimizeImageMany = async (params: OptimizeManyParams) =>
+  execute("optimizeImageMany", params);
+
+export const probeImage = async (params: ProbeParams) =>
+  execute("probeImage", params);
+
 export { waitAll, waitReady, close, setLimit, launchWorker };
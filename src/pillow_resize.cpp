@@ -1,35 +1,133 @@
 #include "pillow_resize.hpp"
+#include "simple_imgproc.h"
+#include "thread_pool.h"
 #include <algorithm>
 #include <cstring>
+#include <list>
+#include <mutex>
 #include <stdexcept>
 
+namespace PillowResize {
+
+// Fixed-point layout follows Pillow-SIMD: int16 coefficients with a per-kernel
+// precision, int32 accumulation.
+constexpr int32_t max_coefs_precision = 16 - 1;
+constexpr int32_t precision_bits = 32 - 8 - 2;
+
 #if HAVE_WASM_SIMD
-// SIMD optimized clipping function
-v128_t clip8_v128(v128_t in) {
-    constexpr uint32_t precision_bits = 32 - 8 - 2;
-    
-    // Shift right to get proper values
-    v128_t shifted = wasm_i32x4_shr(in, precision_bits);
+// SIMD optimized clipping function: (in >> precision) saturated to 0-255,
+// returns 4 packed 8-bit values in the low lane
+static inline v128_t clip8_v128(v128_t in, int32_t coefs_precision) {
+    v128_t shifted = wasm_i32x4_shr(in, coefs_precision);
+    v128_t packed16 = wasm_i16x8_narrow_i32x4(shifted, shifted);
+    return wasm_u8x16_narrow_i16x8(packed16, packed16);
+}
+
+// Same for 16 values held in four i32x4 accumulators
+static inline v128_t clip8x16_v128(v128_t s0, v128_t s1, v128_t s2, v128_t s3, int32_t coefs_precision) {
+    v128_t lo = wasm_i16x8_narrow_i32x4(wasm_i32x4_shr(s0, coefs_precision), wasm_i32x4_shr(s1, coefs_precision));
+    v128_t hi = wasm_i16x8_narrow_i32x4(wasm_i32x4_shr(s2, coefs_precision), wasm_i32x4_shr(s3, coefs_precision));
+    return wasm_u8x16_narrow_i16x8(lo, hi);
+}
+
+// Two int16 coefficients replicated as [k0 k1 k0 k1 ...] for wasm_i32x4_dot_i16x8
+static inline v128_t coeffPair(int16_t k0, int16_t k1) {
+    return wasm_i32x4_splat(static_cast<int32_t>((static_cast<uint32_t>(static_cast<uint16_t>(k1)) << 16) |
+                                                 static_cast<uint16_t>(k0)));
+}
+#endif
+
+// Kernel sampled at kernel_table_resolution points per unit of x; taps are
+// interpolated linearly between samples instead of evaluating sin() twice each.
+// The interpolation error (< 1e-6) is far below the int16 coefficient step.
+constexpr int32_t kernel_table_resolution = 2048;
+
+class KernelTable {
+public:
+    explicit KernelTable(const Filter& filter)
+        : m_support(filter.support()) {
+        const auto size = static_cast<size_t>(ceil(m_support * kernel_table_resolution)) + 2;
+        m_values.resize(size);
+        for (size_t i = 0; i < size; ++i) {
+            m_values[i] = filter.filter(static_cast<double>(i) / kernel_table_resolution);
+        }
+    }
     
-    // Clamp to 0-255 range
-    v128_t zero = wasm_i32x4_splat(0);
-    v128_t max_val = wasm_i32x4_splat(255);
-    v128_t clamped = wasm_i32x4_max(zero, wasm_i32x4_min(shifted, max_val));
+    // The kernels are symmetric, so only x >= 0 is stored
+    double operator()(double x) const {
+        x = std::fabs(x) * kernel_table_resolution;
+        if (x >= m_support * kernel_table_resolution) {
+            return 0.0;
+        }
+        const auto i = static_cast<size_t>(x);
+        const double t = x - static_cast<double>(i);
+        return m_values[i] + (m_values[i + 1] - m_values[i]) * t;
+    }
     
-    // Convert to 8-bit values  
-    return wasm_i16x8_narrow_i32x4(clamped, clamped);
+private:
+    double m_support;
+    std::vector<double> m_values;
+};
+
+// Only Lanczos needs sin(); the other kernels are cheap polynomials
+static const KernelTable* kernelTable(const Filter& filter) {
+    if (filter.type() != FilterType::Lanczos) {
+        return nullptr;
+    }
+    static const KernelTable lanczos(filter);
+    return &lanczos;
 }
-#endif
 
-namespace PillowResize {
+const Filter& filterFor(FilterType type) {
+    static const NearestFilter nearest;
+    static const BoxFilter box;
+    static const BilinearFilter bilinear;
+    static const BicubicFilter bicubic;
+    static const LanczosFilter lanczos;
+    switch (type) {
+        case FilterType::Nearest:
+            return nearest;
+        case FilterType::Box:
+            return box;
+        case FilterType::Bilinear:
+            return bilinear;
+        case FilterType::Bicubic:
+            return bicubic;
+        case FilterType::Lanczos:
+            break;
+    }
+    return lanczos;
+}
+
+// Nearest neighbour as a one-tap kernel, so it runs through the same passes
+static int32_t precomputeNearest(int32_t in_size,
+                                 double in0,
+                                 double in1,
+                                 int32_t out_size,
+                                 std::vector<int32_t>& bounds,
+                                 std::vector<double>& kk) {
+    const double scale = (in1 - in0) / static_cast<double>(out_size);
+    kk.assign(out_size, 1.0);
+    bounds.resize(out_size * 2);
+    for (int32_t xx = 0; xx < out_size; ++xx) {
+        auto x = static_cast<int32_t>(in0 + (xx + 0.5) * scale);
+        bounds[xx * 2 + 0] = std::clamp(x, 0, in_size - 1);
+        bounds[xx * 2 + 1] = 1;
+    }
+    return 1;
+}
 
 int32_t precomputeCoeffs(int32_t in_size,
                         double in0,
                         double in1,
                         int32_t out_size,
-                        const LanczosFilter& filter,
+                        const Filter& filter,
                         std::vector<int32_t>& bounds,
                         std::vector<double>& kk) {
+    if (filter.type() == FilterType::Nearest) {
+        return precomputeNearest(in_size, in0, in1, out_size, bounds, kk);
+    }
+    
     // Prepare for horizontal stretch
     const double scale = (in1 - in0) / static_cast<double>(out_size);
     double filterscale = scale;
@@ -56,6 +154,7 @@ int32_t precomputeCoeffs(int32_t in_size,
 
     int32_t x = 0;
     constexpr double half_pixel = 0.5;
+    const KernelTable* table = kernelTable(filter);
     
     for (int32_t xx = 0; xx < out_size; ++xx) {
         double center = in0 + (xx + half_pixel) * scale;
@@ -67,6 +166,10 @@ int32_t precomputeCoeffs(int32_t in_size,
         if (xmin < 0) {
             xmin = 0;
         }
+        // A source box past the edge can leave the window outside the source
+        if (xmin > in_size - 1) {
+            xmin = in_size - 1;
+        }
         
         // Round the value
         auto xmax = static_cast<int32_t>(center + support + half_pixel);
@@ -74,11 +177,15 @@ int32_t precomputeCoeffs(int32_t in_size,
             xmax = in_size;
         }
         xmax -= xmin;
+        if (xmax < 1) {
+            xmax = 1;
+        }
         
         double* k = &kk[xx * k_size];
         
         for (x = 0; x < xmax; ++x) {
-            double w = filter.filter((x + xmin - center + half_pixel) * ss);
+            const double t = (x + xmin - center + half_pixel) * ss;
+            double w = table ? (*table)(t) : filter.filter(t);
             k[x] = w;
             ww += w;
         }
@@ -88,48 +195,9 @@ int32_t precomputeCoeffs(int32_t in_size,
                 k[x] /= ww;
             }
         }
-        
-        // Scale coefficients for integer computation with SIMD optimization
-        constexpr uint32_t precision_bits = 32 - 8 - 2;
-        constexpr auto shifted_coeff = static_cast<double>(1U << precision_bits);
-        constexpr double half_pixel_round = 0.5;
-        
-        // Process coefficients with SIMD when possible
-        int simd_x = 0;
-        for (; simd_x <= xmax - 4; simd_x += 4) {
-            v128_t coeff_vec = wasm_f64x2_make(k[simd_x], k[simd_x + 1]);
-            v128_t coeff_vec2 = wasm_f64x2_make(k[simd_x + 2], k[simd_x + 3]);
-            v128_t shifted_vec = wasm_f64x2_splat(shifted_coeff);
-            v128_t half_round_pos = wasm_f64x2_splat(half_pixel_round);
-            v128_t half_round_neg = wasm_f64x2_splat(-half_pixel_round);
-            v128_t zero_vec = wasm_f64x2_splat(0.0);
-            
-            // Process first pair
-            v128_t scaled1 = wasm_f64x2_mul(coeff_vec, shifted_vec);
-            v128_t mask1 = wasm_f64x2_lt(coeff_vec, zero_vec);
-            v128_t offset1 = wasm_v128_bitselect(half_round_neg, half_round_pos, mask1);
-            v128_t result1 = wasm_f64x2_add(scaled1, offset1);
-            
-            // Process second pair
-            v128_t scaled2 = wasm_f64x2_mul(coeff_vec2, shifted_vec);
-            v128_t mask2 = wasm_f64x2_lt(coeff_vec2, zero_vec);
-            v128_t offset2 = wasm_v128_bitselect(half_round_neg, half_round_pos, mask2);
-            v128_t result2 = wasm_f64x2_add(scaled2, offset2);
-            
-            // Extract results and truncate
-            k[simd_x] = trunc(wasm_f64x2_extract_lane(result1, 0));
-            k[simd_x + 1] = trunc(wasm_f64x2_extract_lane(result1, 1));
-            k[simd_x + 2] = trunc(wasm_f64x2_extract_lane(result2, 0));
-            k[simd_x + 3] = trunc(wasm_f64x2_extract_lane(result2, 1));
-        }
-        
-        // Process remaining coefficients with scalar code
-        for (x = simd_x; x < xmax; ++x) {
-            if (k[x] < 0) {
-                k[x] = trunc(-half_pixel_round + k[x] * shifted_coeff);
-            } else {
-                k[x] = trunc(half_pixel_round + k[x] * shifted_coeff);
-            }
+        // No weight inside the source: take the edge pixel as is
+        if (ww == 0.0) {
+            k[0] = 1.0;
         }
         
         // Remaining values should stay empty if they are used despite of xmax
@@ -144,9 +212,170 @@ int32_t precomputeCoeffs(int32_t in_size,
     return k_size;
 }
 
-uint8_t clip8(double in) {
-    constexpr uint32_t precision_bits = 32 - 8 - 2;
-    auto saturate_val = static_cast<int64_t>(in) >> precision_bits;
+int32_t normalizeCoeffs8bpc(const std::vector<double>& prekk, std::vector<int16_t>& kk) {
+    double maxkk = prekk.empty() ? 0.0 : prekk[0];
+    for (double k : prekk) {
+        maxkk = std::max(maxkk, k);
+    }
+
+    // Largest precision for which the biggest coefficient still fits into int16
+    int32_t coefs_precision = 0;
+    for (; coefs_precision < precision_bits; ++coefs_precision) {
+        auto next_value = static_cast<int32_t>(0.5 + maxkk * (1 << (coefs_precision + 1)));
+        if (next_value >= (1 << max_coefs_precision)) {
+            break;
+        }
+    }
+
+    kk.resize(prekk.size());
+    const auto scale = static_cast<double>(1 << coefs_precision);
+    for (size_t x = 0; x < prekk.size(); ++x) {
+        if (prekk[x] < 0) {
+            kk[x] = static_cast<int16_t>(trunc(-0.5 + prekk[x] * scale));
+        } else {
+            kk[x] = static_cast<int16_t>(trunc(0.5 + prekk[x] * scale));
+        }
+    }
+
+    return coefs_precision;
+}
+
+namespace {
+
+struct CoeffKey {
+    int32_t in_size;
+    double in0;
+    double in1;
+    int32_t out_size;
+    FilterType filter;
+    
+    bool operator==(const CoeffKey& other) const {
+        return in_size == other.in_size && in0 == other.in0 && in1 == other.in1 &&
+               out_size == other.out_size && filter == other.filter;
+    }
+};
+
+// Process-wide LRU of coefficient tables. Only a handful of geometries are
+// live at a time, so entries are kept in a list ordered by recency.
+class CoeffCache {
+public:
+    std::shared_ptr<const ResampleCoeffs> find(const CoeffKey& key) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->key == key) {
+                m_entries.splice(m_entries.begin(), m_entries, it);
+                ++m_hits;
+                return it->coeffs;
+            }
+        }
+        ++m_misses;
+        return nullptr;
+    }
+    
+    void insert(const CoeffKey& key, std::shared_ptr<const ResampleCoeffs> coeffs) {
+        const size_t bytes = sizeof(ResampleCoeffs) +
+                             coeffs->bounds.size() * sizeof(int32_t) +
+                             coeffs->kk.size() * sizeof(int16_t);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (bytes > m_limit) {
+            return;
+        }
+        for (const Entry& entry : m_entries) {
+            if (entry.key == key) {
+                return; // Computed concurrently by another caller
+            }
+        }
+        m_entries.push_front({key, std::move(coeffs), bytes});
+        m_bytes += bytes;
+        evict();
+    }
+    
+    CoeffCacheStats stats() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        CoeffCacheStats stats;
+        stats.hits = m_hits;
+        stats.misses = m_misses;
+        stats.entries = m_entries.size();
+        stats.bytes = m_bytes;
+        stats.limit = m_limit;
+        return stats;
+    }
+    
+    void setLimit(size_t bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_limit = bytes;
+        evict();
+    }
+    
+    void clear() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_bytes = 0;
+        m_hits = 0;
+        m_misses = 0;
+    }
+    
+private:
+    struct Entry {
+        CoeffKey key;
+        std::shared_ptr<const ResampleCoeffs> coeffs;
+        size_t bytes;
+    };
+    
+    void evict() {
+        while (m_bytes > m_limit && !m_entries.empty()) {
+            m_bytes -= m_entries.back().bytes;
+            m_entries.pop_back();
+        }
+    }
+    
+    std::mutex m_mutex;
+    std::list<Entry> m_entries; // Most recently used first
+    size_t m_bytes = 0;
+    size_t m_limit = 2 * 1024 * 1024;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+};
+
+CoeffCache& coeffCache() {
+    static CoeffCache cache;
+    return cache;
+}
+
+} // namespace
+
+std::shared_ptr<const ResampleCoeffs> getCoeffs(int32_t in_size,
+                                                double in0,
+                                                double in1,
+                                                int32_t out_size,
+                                                const Filter& filter) {
+    const CoeffKey key{in_size, in0, in1, out_size, filter.type()};
+    if (auto cached = coeffCache().find(key)) {
+        return cached;
+    }
+    
+    auto coeffs = std::make_shared<ResampleCoeffs>();
+    std::vector<double> prekk;
+    coeffs->ksize = precomputeCoeffs(in_size, in0, in1, out_size, filter, coeffs->bounds, prekk);
+    coeffs->precision = normalizeCoeffs8bpc(prekk, coeffs->kk);
+    coeffCache().insert(key, coeffs);
+    return coeffs;
+}
+
+CoeffCacheStats coeffCacheStats() {
+    return coeffCache().stats();
+}
+
+void setCoeffCacheLimit(size_t bytes) {
+    coeffCache().setLimit(bytes);
+}
+
+void clearCoeffCache() {
+    coeffCache().clear();
+}
+
+uint8_t clip8(int32_t in, int32_t coefs_precision) {
+    int32_t saturate_val = in >> coefs_precision;
     if (saturate_val < 0) {
         return 0;
     }
@@ -156,46 +385,272 @@ uint8_t clip8(double in) {
     return static_cast<uint8_t>(saturate_val);
 }
 
-// SIMD-optimized clip function for multiple values
-void clip8_simd(const double* input, uint8_t* output, int count) {
-    constexpr uint32_t precision_bits = 32 - 8 - 2;
+static inline int32_t initBuffer(int32_t coefs_precision) {
+    return coefs_precision > 0 ? 1 << (coefs_precision - 1) : 0;
+}
+
+// Single channel: the taps of a window are contiguous bytes
+static void resampleHorizontalRowGray(uint8_t* out,
+                                      const uint8_t* in,
+                                      int32_t out_width,
+                                      int32_t ksize,
+                                      const int32_t* bounds,
+                                      const int16_t* kk,
+                                      int32_t coefs_precision) {
+    const int32_t init_buffer = initBuffer(coefs_precision);
+
+    for (int32_t xx = 0; xx < out_width; ++xx) {
+        const uint8_t* src = in + bounds[xx * 2 + 0];
+        const int32_t xmax = bounds[xx * 2 + 1];
+        const int16_t* k = &kk[xx * ksize];
+
+        int32_t ss = init_buffer;
+        for (int32_t x = 0; x < xmax; ++x) {
+            ss += static_cast<int32_t>(src[x]) * k[x];
+        }
+        out[xx] = clip8(ss, coefs_precision);
+    }
+}
+
+void resampleHorizontalRow(uint8_t* out,
+                           const uint8_t* in,
+                           int32_t out_width,
+                           int32_t channels,
+                           int32_t ksize,
+                           const int32_t* bounds,
+                           const int16_t* kk,
+                           int32_t coefs_precision) {
+    if (channels == 1) {
+        resampleHorizontalRowGray(out, in, out_width, ksize, bounds, kk, coefs_precision);
+        return;
+    }
+
+    const int32_t init_buffer = initBuffer(coefs_precision);
+
+    for (int32_t xx = 0; xx < out_width; ++xx) {
+        int32_t xmin = bounds[xx * 2 + 0];
+        int32_t xmax = bounds[xx * 2 + 1];
+        const int16_t* k = &kk[xx * ksize];
+        const uint8_t* src = in + xmin * channels;
+
+        for (int32_t c = 0; c < channels; ++c) {
+            int32_t ss = init_buffer;
+            for (int32_t x = 0; x < xmax; ++x) {
+                ss += static_cast<int32_t>(src[x * channels + c]) * k[x];
+            }
+            out[xx * channels + c] = clip8(ss, coefs_precision);
+        }
+    }
+}
+
+void resampleVerticalRow(uint8_t* out,
+                         const uint8_t* const* in_rows,
+                         int32_t row_bytes,
+                         int32_t ymax,
+                         const int16_t* k,
+                         int32_t coefs_precision) {
+    const int32_t init_buffer = initBuffer(coefs_precision);
+
+    for (int32_t x = 0; x < row_bytes; ++x) {
+        int32_t ss = init_buffer;
+        for (int32_t y = 0; y < ymax; ++y) {
+            ss += static_cast<int32_t>(in_rows[y][x]) * k[y];
+        }
+        out[x] = clip8(ss, coefs_precision);
+    }
+}
+
+#if HAVE_WASM_SIMD
+// Accumulate one output pixel of a 3 or 4 channel row. Pixels are taken in
+// pairs and reordered to [c0(p0) c0(p1) c1(p0) c1(p1) ...] so that a single
+// wasm_i32x4_dot_i16x8 against [k0 k1 k0 k1 ...] yields one sum per channel.
+template<int32_t CHANNELS>
+static inline v128_t accumulatePixelSIMD(const uint8_t* src,
+                                         const uint8_t* row_end,
+                                         int32_t xmax,
+                                         const int16_t* k,
+                                         v128_t sss) {
+    static_assert(CHANNELS == 3 || CHANNELS == 4, "3 or 4 channels");
     const v128_t zero = wasm_i32x4_splat(0);
-    const v128_t max_val = wasm_i32x4_splat(255);
-    
-    int i = 0;
-    // Process 4 values at a time with SIMD
-    for (; i <= count - 4; i += 4) {
-        // Convert doubles to integers with right shift
-        v128_t vals = wasm_i32x4_make(
-            static_cast<int32_t>(static_cast<int64_t>(input[i]) >> precision_bits),
-            static_cast<int32_t>(static_cast<int64_t>(input[i+1]) >> precision_bits),
-            static_cast<int32_t>(static_cast<int64_t>(input[i+2]) >> precision_bits),
-            static_cast<int32_t>(static_cast<int64_t>(input[i+3]) >> precision_bits)
-        );
-        
-        // Clamp to [0, 255] range
-        v128_t clamped = wasm_i32x4_max(zero, wasm_i32x4_min(vals, max_val));
-        
-        // Extract and store results
-        output[i] = static_cast<uint8_t>(wasm_i32x4_extract_lane(clamped, 0));
-        output[i+1] = static_cast<uint8_t>(wasm_i32x4_extract_lane(clamped, 1));
-        output[i+2] = static_cast<uint8_t>(wasm_i32x4_extract_lane(clamped, 2));
-        output[i+3] = static_cast<uint8_t>(wasm_i32x4_extract_lane(clamped, 3));
+    int32_t x = 0;
+
+    // 4 taps per iteration from one 16-byte load
+    for (; x + 4 <= xmax && src + x * CHANNELS + 16 <= row_end; x += 4) {
+        v128_t pix = wasm_v128_load(src + x * CHANNELS);
+        v128_t pairs;
+        if (CHANNELS == 4) {
+            pairs = wasm_i8x16_shuffle(pix, zero, 0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+        } else {
+            pairs = wasm_i8x16_shuffle(pix, zero, 0, 3, 1, 4, 2, 5, 16, 16, 6, 9, 7, 10, 8, 11, 16, 16);
+        }
+        sss = wasm_i32x4_add(sss, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(pairs), coeffPair(k[x], k[x + 1])));
+        sss = wasm_i32x4_add(sss, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(pairs), coeffPair(k[x + 2], k[x + 3])));
     }
-    
-    // Process remaining values with scalar code
-    for (; i < count; ++i) {
-        output[i] = clip8(input[i]);
+
+    // 2 taps per iteration from one 8-byte load
+    for (; x + 2 <= xmax && src + x * CHANNELS + 8 <= row_end; x += 2) {
+        v128_t pix = wasm_v128_load64_zero(src + x * CHANNELS);
+        v128_t pairs;
+        if (CHANNELS == 4) {
+            pairs = wasm_i8x16_shuffle(pix, zero, 0, 4, 1, 5, 2, 6, 3, 7, 16, 16, 16, 16, 16, 16, 16, 16);
+        } else {
+            pairs = wasm_i8x16_shuffle(pix, zero, 0, 3, 1, 4, 2, 5, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16);
+        }
+        sss = wasm_i32x4_add(sss, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(pairs), coeffPair(k[x], k[x + 1])));
+    }
+
+    // Remaining taps (and taps too close to the end of the buffer for a wide load)
+    for (; x < xmax; ++x) {
+        const uint8_t* p = src + x * CHANNELS;
+        v128_t pix = wasm_i32x4_make(p[0], p[1], p[2], CHANNELS == 4 ? p[3] : 0);
+        sss = wasm_i32x4_add(sss, wasm_i32x4_dot_i16x8(pix, coeffPair(k[x], 0)));
+    }
+    return sss;
+}
+
+template<int32_t CHANNELS>
+static void resampleHorizontalRowSIMDImpl(uint8_t* out,
+                                          const uint8_t* in,
+                                          const uint8_t* in_end,
+                                          int32_t out_width,
+                                          int32_t ksize,
+                                          const int32_t* bounds,
+                                          const int16_t* kk,
+                                          int32_t coefs_precision) {
+    const v128_t init = wasm_i32x4_splat(initBuffer(coefs_precision));
+
+    for (int32_t xx = 0; xx < out_width; ++xx) {
+        int32_t xmin = bounds[xx * 2 + 0];
+        int32_t xmax = bounds[xx * 2 + 1];
+        v128_t sss = accumulatePixelSIMD<CHANNELS>(in + xmin * CHANNELS, in_end, xmax, &kk[xx * ksize], init);
+        v128_t packed = clip8_v128(sss, coefs_precision);
+
+        uint8_t* dst = out + xx * CHANNELS;
+        if (CHANNELS == 4) {
+            wasm_v128_store32_lane(dst, packed, 0);
+        } else {
+            dst[0] = wasm_u8x16_extract_lane(packed, 0);
+            dst[1] = wasm_u8x16_extract_lane(packed, 1);
+            dst[2] = wasm_u8x16_extract_lane(packed, 2);
+        }
     }
 }
 
+// Single channel: 8 contiguous taps are widened to i16 and multiplied with 8
+// coefficients straight from the kernel in one dot product
+static void resampleHorizontalRowGraySIMD(uint8_t* out,
+                                          const uint8_t* in,
+                                          const uint8_t* in_end,
+                                          int32_t out_width,
+                                          int32_t ksize,
+                                          const int32_t* bounds,
+                                          const int16_t* kk,
+                                          int32_t coefs_precision) {
+    const int32_t init_buffer = initBuffer(coefs_precision);
+
+    for (int32_t xx = 0; xx < out_width; ++xx) {
+        const uint8_t* src = in + bounds[xx * 2 + 0];
+        const int32_t xmax = bounds[xx * 2 + 1];
+        const int16_t* k = &kk[xx * ksize];
+
+        v128_t sss = wasm_i32x4_splat(0);
+        int32_t x = 0;
+        for (; x + 8 <= xmax && src + x + 8 <= in_end; x += 8) {
+            sss = wasm_i32x4_add(sss, wasm_i32x4_dot_i16x8(wasm_u16x8_load8x8(src + x), wasm_v128_load(k + x)));
+        }
+        int32_t ss = init_buffer + wasm_i32x4_extract_lane(sss, 0) + wasm_i32x4_extract_lane(sss, 1) +
+                     wasm_i32x4_extract_lane(sss, 2) + wasm_i32x4_extract_lane(sss, 3);
+        for (; x < xmax; ++x) {
+            ss += static_cast<int32_t>(src[x]) * k[x];
+        }
+        out[xx] = clip8(ss, coefs_precision);
+    }
+}
+
+// in_end bounds the wide loads; it must not be before the end of the input row
+void resampleHorizontalRowSIMD(uint8_t* out,
+                               const uint8_t* in,
+                               const uint8_t* in_end,
+                               int32_t out_width,
+                               int32_t channels,
+                               int32_t ksize,
+                               const int32_t* bounds,
+                               const int16_t* kk,
+                               int32_t coefs_precision) {
+    if (channels == 4) {
+        resampleHorizontalRowSIMDImpl<4>(out, in, in_end, out_width, ksize, bounds, kk, coefs_precision);
+    } else if (channels == 3) {
+        resampleHorizontalRowSIMDImpl<3>(out, in, in_end, out_width, ksize, bounds, kk, coefs_precision);
+    } else if (channels == 1) {
+        resampleHorizontalRowGraySIMD(out, in, in_end, out_width, ksize, bounds, kk, coefs_precision);
+    } else {
+        // Fallback to scalar processing for other channel counts
+        resampleHorizontalRow(out, in, out_width, channels, ksize, bounds, kk, coefs_precision);
+    }
+}
+
+// Vertical pass works on raw bytes, so it is independent of the channel count.
+// Two source rows are interleaved byte-wise so that one dot product applies
+// both of their coefficients.
+void resampleVerticalRowSIMD(uint8_t* out,
+                             const uint8_t* const* in_rows,
+                             int32_t row_bytes,
+                             int32_t ymax,
+                             const int16_t* k,
+                             int32_t coefs_precision) {
+    const v128_t init = wasm_i32x4_splat(initBuffer(coefs_precision));
+    const v128_t zero = wasm_i32x4_splat(0);
+
+    int32_t x = 0;
+    for (; x + 16 <= row_bytes; x += 16) {
+        v128_t s0 = init, s1 = init, s2 = init, s3 = init;
+        int32_t y = 0;
+        for (; y + 2 <= ymax; y += 2) {
+            v128_t a = wasm_v128_load(in_rows[y] + x);
+            v128_t b = wasm_v128_load(in_rows[y + 1] + x);
+            v128_t mmk = coeffPair(k[y], k[y + 1]);
+            v128_t lo = wasm_i8x16_shuffle(a, b, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+            v128_t hi = wasm_i8x16_shuffle(a, b, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+            s0 = wasm_i32x4_add(s0, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(lo), mmk));
+            s1 = wasm_i32x4_add(s1, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(lo), mmk));
+            s2 = wasm_i32x4_add(s2, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(hi), mmk));
+            s3 = wasm_i32x4_add(s3, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(hi), mmk));
+        }
+        if (y < ymax) {
+            v128_t a = wasm_v128_load(in_rows[y] + x);
+            v128_t mmk = coeffPair(k[y], 0);
+            v128_t lo = wasm_i8x16_shuffle(a, zero, 0, 16, 1, 16, 2, 16, 3, 16, 4, 16, 5, 16, 6, 16, 7, 16);
+            v128_t hi = wasm_i8x16_shuffle(a, zero, 8, 16, 9, 16, 10, 16, 11, 16, 12, 16, 13, 16, 14, 16, 15, 16);
+            s0 = wasm_i32x4_add(s0, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(lo), mmk));
+            s1 = wasm_i32x4_add(s1, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(lo), mmk));
+            s2 = wasm_i32x4_add(s2, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(hi), mmk));
+            s3 = wasm_i32x4_add(s3, wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(hi), mmk));
+        }
+        wasm_v128_store(out + x, clip8x16_v128(s0, s1, s2, s3, coefs_precision));
+    }
+
+    // Process the remaining bytes with scalar code
+    if (x < row_bytes) {
+        const int32_t init_buffer = initBuffer(coefs_precision);
+        for (; x < row_bytes; ++x) {
+            int32_t ss = init_buffer;
+            for (int32_t y = 0; y < ymax; ++y) {
+                ss += static_cast<int32_t>(in_rows[y][x]) * k[y];
+            }
+            out[x] = clip8(ss, coefs_precision);
+        }
+    }
+}
+#endif
+
 template<typename T>
 void resampleHorizontal(SimpleImage& im_out,
                        const SimpleImage& im_in,
                        int32_t offset,
                        int32_t ksize,
                        const std::vector<int32_t>& bounds,
-                       const std::vector<double>& kk);
+                       const std::vector<int16_t>& kk,
+                       int32_t coefs_precision);
 
 template<>
 void resampleHorizontal<uint8_t>(SimpleImage& im_out,
@@ -203,31 +658,16 @@ void resampleHorizontal<uint8_t>(SimpleImage& im_out,
                                 int32_t offset,
                                 int32_t ksize,
                                 const std::vector<int32_t>& bounds,
-                                const std::vector<double>& kk) {
-    int32_t ss0 = im_in.cols();
-    int32_t ss1 = im_in.channels();
-    
-    constexpr uint32_t precision_bits = 32 - 8 - 2;
-    const double init_buffer = static_cast<double>(1U << (precision_bits - 1U));
-    
-    for (int32_t yy = 0; yy < im_out.rows(); ++yy) {
-        for (int32_t xx = 0; xx < im_out.cols(); ++xx) {
-            int32_t xmin = bounds[xx * 2 + 0];
-            int32_t xmax = bounds[xx * 2 + 1];
-            const double* k = &kk[xx * ksize];
-            
-            for (int32_t c = 0; c < ss1; ++c) {
-                double ss = init_buffer;
-                for (int32_t x = 0; x < xmax; ++x) {
-                    const uint8_t* src_ptr = im_in.ptr<uint8_t>(yy + offset) + (x + xmin) * ss1 + c;
-                    ss += static_cast<double>(*src_ptr) * k[x];
-                }
-                
-                uint8_t* dst_ptr = im_out.ptr<uint8_t>(yy) + xx * ss1 + c;
-                *dst_ptr = clip8(ss);
-            }
+                                const std::vector<int16_t>& kk,
+                                int32_t coefs_precision) {
+    const int64_t row_cost = static_cast<int64_t>(im_out.cols()) * im_out.channels() * ksize;
+    thread_pool::parallelFor(im_out.rows(), row_cost, [&](int32_t begin, int32_t end) {
+        for (int32_t yy = begin; yy < end; ++yy) {
+            resampleHorizontalRow(im_out.ptr<uint8_t>(yy), im_in.ptr<uint8_t>(yy + offset),
+                                  im_out.cols(), im_in.channels(), ksize,
+                                  bounds.data(), kk.data(), coefs_precision);
         }
-    }
+    });
 }
 
 #if HAVE_WASM_SIMD
@@ -237,70 +677,17 @@ void resampleHorizontalSIMD(SimpleImage& im_out,
                             int32_t offset,
                             int32_t ksize,
                             const std::vector<int32_t>& bounds,
-                            const std::vector<double>& kk) {
-    const int32_t ss0 = im_in.cols();
-    const int32_t ss1 = im_in.channels();
-    
-    constexpr uint32_t precision_bits = 32 - 8 - 2;
-    const double init_buffer = static_cast<double>(1U << (precision_bits - 1U));
-    
-    // Process pixels with both SIMD and scalar fallback
-    for (int32_t yy = 0; yy < im_out.rows(); ++yy) {
-        for (int32_t xx = 0; xx < im_out.cols(); ++xx) {
-            int32_t xmin = bounds[xx * 2 + 0];
-            int32_t xmax = bounds[xx * 2 + 1];
-            const double* k = &kk[xx * ksize];
-            
-            // For RGB/RGBA channels, process with optimized code
-            if (ss1 == 3 || ss1 == 4) {
-                // Accumulate results for all channels
-                double results[4] = {init_buffer, init_buffer, init_buffer, init_buffer};
-                
-                for (int32_t x = 0; x < xmax; ++x) {
-                    const uint8_t* src_ptr = im_in.ptr<uint8_t>(yy + offset) + (x + xmin) * ss1;
-                    double coeff = k[x];
-                    
-                    // Optimized SIMD processing with vectorized coefficient multiplication
-                    v128_t pixels = wasm_i32x4_make(src_ptr[0], src_ptr[1], 
-                                                   ss1 > 2 ? src_ptr[2] : 0, 
-                                                   ss1 > 3 ? src_ptr[3] : 0);
-                    
-                    // Convert pixels to float and multiply all at once
-                    v128_t pixels_f1 = wasm_f64x2_convert_low_i32x4(pixels);
-                    v128_t pixels_f2 = wasm_f64x2_make(
-                        ss1 > 2 ? static_cast<double>(src_ptr[2]) : 0.0,
-                        ss1 > 3 ? static_cast<double>(src_ptr[3]) : 0.0
-                    );
-                    v128_t coeff_vec = wasm_f64x2_splat(coeff);
-                    
-                    v128_t weighted1 = wasm_f64x2_mul(pixels_f1, coeff_vec);
-                    v128_t weighted2 = wasm_f64x2_mul(pixels_f2, coeff_vec);
-                    
-                    // Accumulate results
-                    results[0] += wasm_f64x2_extract_lane(weighted1, 0);
-                    results[1] += wasm_f64x2_extract_lane(weighted1, 1);
-                    if (ss1 > 2) results[2] += wasm_f64x2_extract_lane(weighted2, 0);
-                    if (ss1 > 3) results[3] += wasm_f64x2_extract_lane(weighted2, 1);
-                }
-                
-                // Clip and store results using optimized SIMD clip function
-                uint8_t* dst_ptr = im_out.ptr<uint8_t>(yy) + xx * ss1;
-                clip8_simd(results, dst_ptr, ss1);
-            } else {
-                // Fallback to scalar processing for other channel counts
-                for (int32_t c = 0; c < ss1; ++c) {
-                    double ss = init_buffer;
-                    for (int32_t x = 0; x < xmax; ++x) {
-                        const uint8_t* src_ptr = im_in.ptr<uint8_t>(yy + offset) + (x + xmin) * ss1 + c;
-                        ss += static_cast<double>(*src_ptr) * k[x];
-                    }
-                    
-                    uint8_t* dst_ptr = im_out.ptr<uint8_t>(yy) + xx * ss1 + c;
-                    *dst_ptr = clip8(ss);
-                }
-            }
+                            const std::vector<int16_t>& kk,
+                            int32_t coefs_precision) {
+    const uint8_t* in_end = im_in.data() + static_cast<size_t>(im_in.rows()) * im_in.cols() * im_in.channels();
+    const int64_t row_cost = static_cast<int64_t>(im_out.cols()) * im_in.channels() * ksize;
+    thread_pool::parallelFor(im_out.rows(), row_cost, [&](int32_t begin, int32_t end) {
+        for (int32_t yy = begin; yy < end; ++yy) {
+            resampleHorizontalRowSIMD(im_out.ptr<uint8_t>(yy), im_in.ptr<uint8_t>(yy + offset), in_end,
+                                      im_out.cols(), im_in.channels(), ksize,
+                                      bounds.data(), kk.data(), coefs_precision);
         }
-    }
+    });
 }
 #endif
 
@@ -310,7 +697,8 @@ void resampleVertical(SimpleImage& im_out,
                      int32_t offset,
                      int32_t ksize,
                      const std::vector<int32_t>& bounds,
-                     const std::vector<double>& kk);
+                     const std::vector<int16_t>& kk,
+                     int32_t coefs_precision);
 
 template<>
 void resampleVertical<uint8_t>(SimpleImage& im_out,
@@ -318,31 +706,21 @@ void resampleVertical<uint8_t>(SimpleImage& im_out,
                               int32_t offset,
                               int32_t ksize,
                               const std::vector<int32_t>& bounds,
-                              const std::vector<double>& kk) {
-    int32_t ss0 = im_in.cols();
-    int32_t ss1 = im_in.channels();
-    
-    constexpr uint32_t precision_bits = 32 - 8 - 2;
-    const double init_buffer = static_cast<double>(1U << (precision_bits - 1U));
-    
-    for (int32_t yy = 0; yy < im_out.rows(); ++yy) {
-        int32_t ymin = bounds[yy * 2 + 0];
-        int32_t ymax = bounds[yy * 2 + 1];
-        const double* k = &kk[yy * ksize];
-        
-        for (int32_t xx = 0; xx < im_out.cols(); ++xx) {
-            for (int32_t c = 0; c < ss1; ++c) {
-                double ss = init_buffer;
-                for (int32_t y = 0; y < ymax; ++y) {
-                    const uint8_t* src_ptr = im_in.ptr<uint8_t>(y + ymin) + xx * ss1 + c;
-                    ss += static_cast<double>(*src_ptr) * k[y];
-                }
-                
-                uint8_t* dst_ptr = im_out.ptr<uint8_t>(yy) + xx * ss1 + c;
-                *dst_ptr = clip8(ss);
+                              const std::vector<int16_t>& kk,
+                              int32_t coefs_precision) {
+    const int32_t row_bytes = im_out.cols() * im_out.channels();
+    thread_pool::parallelFor(im_out.rows(), static_cast<int64_t>(row_bytes) * ksize, [&](int32_t begin, int32_t end) {
+        std::vector<const uint8_t*> rows(ksize);
+        for (int32_t yy = begin; yy < end; ++yy) {
+            int32_t ymin = bounds[yy * 2 + 0] + offset;
+            int32_t ymax = bounds[yy * 2 + 1];
+            for (int32_t y = 0; y < ymax; ++y) {
+                rows[y] = im_in.ptr<uint8_t>(ymin + y);
             }
+            resampleVerticalRow(im_out.ptr<uint8_t>(yy), rows.data(), row_bytes, ymax,
+                                &kk[yy * ksize], coefs_precision);
         }
-    }
+    });
 }
 
 #if HAVE_WASM_SIMD
@@ -352,219 +730,391 @@ void resampleVerticalSIMD(SimpleImage& im_out,
                          int32_t offset,
                          int32_t ksize,
                          const std::vector<int32_t>& bounds,
-                         const std::vector<double>& kk) {
-    const int32_t ss0 = im_in.cols();
-    const int32_t ss1 = im_in.channels();
-    
-    constexpr uint32_t precision_bits = 32 - 8 - 2;
-    const double init_buffer = static_cast<double>(1U << (precision_bits - 1U));
-    
-    for (int32_t yy = 0; yy < im_out.rows(); ++yy) {
-        int32_t ymin = bounds[yy * 2 + 0];
-        int32_t ymax = bounds[yy * 2 + 1];
-        const double* k = &kk[yy * ksize];
-        
-        for (int32_t xx = 0; xx < im_out.cols(); ++xx) {
-            // For RGB/RGBA channels, process with optimized code
-            if (ss1 == 3 || ss1 == 4) {
-                // Accumulate results for all channels
-                double results[4] = {init_buffer, init_buffer, init_buffer, init_buffer};
-                
-                for (int32_t y = 0; y < ymax; ++y) {
-                    const uint8_t* src_ptr = im_in.ptr<uint8_t>(y + ymin) + xx * ss1;
-                    double coeff = k[y];
-                    
-                    // Optimized SIMD processing with vectorized coefficient multiplication
-                    v128_t pixels = wasm_i32x4_make(src_ptr[0], src_ptr[1], 
-                                                   ss1 > 2 ? src_ptr[2] : 0, 
-                                                   ss1 > 3 ? src_ptr[3] : 0);
-                    
-                    // Convert pixels to float and multiply all at once
-                    v128_t pixels_f1 = wasm_f64x2_convert_low_i32x4(pixels);
-                    v128_t pixels_f2 = wasm_f64x2_make(
-                        ss1 > 2 ? static_cast<double>(src_ptr[2]) : 0.0,
-                        ss1 > 3 ? static_cast<double>(src_ptr[3]) : 0.0
-                    );
-                    v128_t coeff_vec = wasm_f64x2_splat(coeff);
-                    
-                    v128_t weighted1 = wasm_f64x2_mul(pixels_f1, coeff_vec);
-                    v128_t weighted2 = wasm_f64x2_mul(pixels_f2, coeff_vec);
-                    
-                    // Accumulate results
-                    results[0] += wasm_f64x2_extract_lane(weighted1, 0);
-                    results[1] += wasm_f64x2_extract_lane(weighted1, 1);
-                    if (ss1 > 2) results[2] += wasm_f64x2_extract_lane(weighted2, 0);
-                    if (ss1 > 3) results[3] += wasm_f64x2_extract_lane(weighted2, 1);
-                }
-                
-                // Clip and store results using optimized SIMD clip function
-                uint8_t* dst_ptr = im_out.ptr<uint8_t>(yy) + xx * ss1;
-                clip8_simd(results, dst_ptr, ss1);
-            } else {
-                // Fallback to scalar processing for other channel counts
-                for (int32_t c = 0; c < ss1; ++c) {
-                    double ss = init_buffer;
-                    for (int32_t y = 0; y < ymax; ++y) {
-                        const uint8_t* src_ptr = im_in.ptr<uint8_t>(y + ymin) + xx * ss1 + c;
-                        ss += static_cast<double>(*src_ptr) * k[y];
-                    }
-                    
-                    uint8_t* dst_ptr = im_out.ptr<uint8_t>(yy) + xx * ss1 + c;
-                    *dst_ptr = clip8(ss);
-                }
+                         const std::vector<int16_t>& kk,
+                         int32_t coefs_precision) {
+    const int32_t row_bytes = im_out.cols() * im_out.channels();
+    thread_pool::parallelFor(im_out.rows(), static_cast<int64_t>(row_bytes) * ksize, [&](int32_t begin, int32_t end) {
+        std::vector<const uint8_t*> rows(ksize);
+        for (int32_t yy = begin; yy < end; ++yy) {
+            int32_t ymin = bounds[yy * 2 + 0] + offset;
+            int32_t ymax = bounds[yy * 2 + 1];
+            for (int32_t y = 0; y < ymax; ++y) {
+                rows[y] = im_in.ptr<uint8_t>(ymin + y);
             }
+            resampleVerticalRowSIMD(im_out.ptr<uint8_t>(yy), rows.data(), row_bytes, ymax,
+                                    &kk[yy * ksize], coefs_precision);
         }
-    }
+    });
 }
 #endif
 
-// Transpose function for SimpleImage with SIMD optimization
-SimpleImage transpose(const SimpleImage& src) {
-    if (src.empty()) return SimpleImage();
-    
-    SimpleImage dst(src.cols(), src.rows(), src.channels());
-    
-    const int channels = src.channels();
-    
-    // SIMD-optimized transpose for RGB/RGBA images
-    if (channels == 3 || channels == 4) {
-        for (int y = 0; y < src.rows(); y++) {
-            for (int x = 0; x < src.cols(); x++) {
-                const uint8_t* src_ptr = src.ptr<uint8_t>(y) + x * channels;
-                uint8_t* dst_ptr = dst.ptr<uint8_t>(x) + y * channels;
-                
-                // Use SIMD to copy pixel data
-                v128_t pixel_data = wasm_i32x4_make(
-                    src_ptr[0], src_ptr[1], 
-                    channels > 2 ? src_ptr[2] : 0,
-                    channels > 3 ? src_ptr[3] : 0
-                );
-                
-                dst_ptr[0] = static_cast<uint8_t>(wasm_i32x4_extract_lane(pixel_data, 0));
-                dst_ptr[1] = static_cast<uint8_t>(wasm_i32x4_extract_lane(pixel_data, 1));
-                if (channels > 2) dst_ptr[2] = static_cast<uint8_t>(wasm_i32x4_extract_lane(pixel_data, 2));
-                if (channels > 3) dst_ptr[3] = static_cast<uint8_t>(wasm_i32x4_extract_lane(pixel_data, 3));
-            }
-        }
-    } else {
-        // Fallback to scalar transpose for other channel counts
-        for (int y = 0; y < src.rows(); y++) {
-            for (int x = 0; x < src.cols(); x++) {
-                for (int c = 0; c < channels; c++) {
-                    const uint8_t* src_ptr = src.ptr<uint8_t>(y) + x * channels + c;
-                    uint8_t* dst_ptr = dst.ptr<uint8_t>(x) + y * channels + c;
-                    *dst_ptr = *src_ptr;
-                }
+BoxReducer::BoxReducer(int32_t in_width, int32_t channels, int32_t factor_x, int32_t factor_y)
+    : m_in_width(in_width),
+      m_channels(channels),
+      m_factor_x(factor_x),
+      m_factor_y(factor_y),
+      m_out_width((in_width + factor_x - 1) / factor_x),
+      m_sums(static_cast<size_t>(in_width) * channels, 0) {
+}
+
+void BoxReducer::addRow(const uint8_t* row) {
+    const int32_t n = m_in_width * m_channels;
+    uint32_t* sums = m_sums.data();
+    int32_t i = 0;
+#if HAVE_WASM_SIMD
+    // Widen 16 samples to u32 and add them to the column sums
+    for (; i + 16 <= n; i += 16) {
+        const v128_t px = wasm_v128_load(row + i);
+        const v128_t lo = wasm_u16x8_extend_low_u8x16(px);
+        const v128_t hi = wasm_u16x8_extend_high_u8x16(px);
+        wasm_v128_store(sums + i, wasm_i32x4_add(wasm_v128_load(sums + i), wasm_u32x4_extend_low_u16x8(lo)));
+        wasm_v128_store(sums + i + 4, wasm_i32x4_add(wasm_v128_load(sums + i + 4), wasm_u32x4_extend_high_u16x8(lo)));
+        wasm_v128_store(sums + i + 8, wasm_i32x4_add(wasm_v128_load(sums + i + 8), wasm_u32x4_extend_low_u16x8(hi)));
+        wasm_v128_store(sums + i + 12, wasm_i32x4_add(wasm_v128_load(sums + i + 12), wasm_u32x4_extend_high_u16x8(hi)));
+    }
+#endif
+    for (; i < n; ++i) {
+        sums[i] += row[i];
+    }
+}
+
+void BoxReducer::emitRow(uint8_t* out, int32_t rows_added) {
+    for (int32_t xx = 0; xx < m_out_width; ++xx) {
+        const int32_t x0 = xx * m_factor_x;
+        const int32_t width = std::min(m_factor_x, m_in_width - x0);
+        const auto count = static_cast<uint32_t>(width * rows_added);
+        const uint32_t* s = &m_sums[static_cast<size_t>(x0) * m_channels];
+        for (int32_t c = 0; c < m_channels; ++c) {
+            uint32_t sum = 0;
+            for (int32_t x = 0; x < width; ++x) {
+                sum += s[x * m_channels + c];
             }
+            out[xx * m_channels + c] = static_cast<uint8_t>((sum + count / 2) / count);
         }
     }
-    
-    return dst;
+    std::fill(m_sums.begin(), m_sums.end(), 0);
 }
 
-SimpleImage resize(const SimpleImage& src, const SimpleSize& out_size) {
-    if (src.empty()) {
+SimpleImage reduceBox(const SimpleImage& src, int32_t factor_x, int32_t factor_y) {
+    if (src.empty() || factor_x < 1 || factor_y < 1) {
         return SimpleImage();
     }
     
-    const int32_t x_size = out_size.width;
-    const int32_t y_size = out_size.height;
+    const int32_t out_width = (src.cols() + factor_x - 1) / factor_x;
+    const int32_t out_height = (src.rows() + factor_y - 1) / factor_y;
+    SimpleImage dst(out_height, out_width, src.channels(), src.pixelFormat());
     
-    if (x_size < 1 || y_size < 1) {
-        throw std::runtime_error("Output size must be positive");
+    const int64_t row_cost = static_cast<int64_t>(src.cols()) * src.channels() * factor_y;
+    thread_pool::parallelFor(out_height, row_cost, [&](int32_t begin, int32_t end) {
+        BoxReducer reducer(src.cols(), src.channels(), factor_x, factor_y);
+        for (int32_t yy = begin; yy < end; ++yy) {
+            const int32_t y0 = yy * factor_y;
+            const int32_t rows = std::min(factor_y, src.rows() - y0);
+            for (int32_t y = 0; y < rows; ++y) {
+                reducer.addRow(src.ptr<uint8_t>(y0 + y));
+            }
+            reducer.emitRow(dst.ptr<uint8_t>(yy), rows);
+        }
+    });
+    return dst;
+}
+
+// Integer box reduction factors applied before resampling. A box filter
+// with an integer ratio on both axes is a plain block average; otherwise
+// reducing_gap picks factors as Pillow does, int(in / out / reducing_gap).
+static void boxReduceFactors(FilterType filter, double reducing_gap,
+                             int32_t in_width, int32_t in_height,
+                             int32_t out_width, int32_t out_height,
+                             int32_t& factor_x, int32_t& factor_y) {
+    factor_x = 1;
+    factor_y = 1;
+    if (filter == FilterType::Box &&
+        in_width % out_width == 0 && in_height % out_height == 0) {
+        factor_x = in_width / out_width;
+        factor_y = in_height / out_height;
+    } else if (reducing_gap >= 1.0 && filter != FilterType::Nearest) {
+        factor_x = std::max(1, static_cast<int32_t>(in_width / (static_cast<double>(out_width) * reducing_gap)));
+        factor_y = std::max(1, static_cast<int32_t>(in_height / (static_cast<double>(out_height) * reducing_gap)));
     }
+}
+
+// Two-pass resample of [0, box_width) x [0, box_height) of src. The box is
+// the source area in src pixels; it is fractional after a box reduction that
+// leaves partial edge blocks. The last pass stores its rows at the EXIF
+// orientation, so rotated output needs no separate rotate and copy.
+static SimpleImage resample(const SimpleImage& src, int32_t x_size, int32_t y_size,
+                            double box_width, double box_height, const Filter& filter,
+                            int orientation) {
+    const bool need_horizontal = x_size != src.cols() || box_width != src.cols();
+    const bool need_vertical = y_size != src.rows() || box_height != src.rows();
+    const int32_t channels = src.channels();
+    const int32_t row_bytes = x_size * channels;
     
-    // Create Lanczos filter
-    LanczosFilter filter;
-    
-    SimpleImage im_out;
-    SimpleImage im_temp;
+    // Horizontal filter coefficients
+    std::shared_ptr<const ResampleCoeffs> horiz;
+    if (need_horizontal) {
+        horiz = getCoeffs(src.cols(), 0.0, box_width, x_size, filter);
+    }
     
-    std::vector<int32_t> bounds_horiz;
+    // Vertical filter coefficients; bounds are copied since the horizontal
+    // pass shifts them to the cropped temporary image
+    std::shared_ptr<const ResampleCoeffs> vert;
     std::vector<int32_t> bounds_vert;
-    std::vector<double> kk_horiz;
-    std::vector<double> kk_vert;
-    
-    const bool need_horizontal = x_size != src.cols();
-    const bool need_vertical = y_size != src.rows();
+    if (need_vertical) {
+        vert = getCoeffs(src.rows(), 0.0, box_height, y_size, filter);
+        bounds_vert = vert->bounds;
+    }
     
-    // Compute horizontal filter coefficients
-    int32_t ksize_horiz = 0;
-    if (need_horizontal) {
-        ksize_horiz = precomputeCoeffs(src.cols(), 0.0, 
-                                      static_cast<double>(src.cols()), 
-                                      x_size, filter, bounds_horiz, kk_horiz);
+    const SimpleSize out_size = simple_imgproc::orientedSize(x_size, y_size, orientation);
+    SimpleImage im_out(out_size.height, out_size.width, channels, src.pixelFormat());
+    if (im_out.empty()) {
+        throw std::runtime_error("Failed to allocate output image");
     }
     
-    // Compute vertical filter coefficients
-    int32_t ksize_vert = 0;
-    if (need_vertical) {
-        ksize_vert = precomputeCoeffs(src.rows(), 0.0, 
-                                     static_cast<double>(src.rows()), 
-                                     y_size, filter, bounds_vert, kk_vert);
+    // Horizontal pass (or a plain copy) is the last one
+    if (!need_vertical) {
+#if HAVE_WASM_SIMD
+        const uint8_t* in_end = src.data() + static_cast<size_t>(src.rows()) * src.cols() * channels;
+#endif
+        const int64_t row_cost = static_cast<int64_t>(row_bytes) * (need_horizontal ? horiz->ksize : 1);
+        thread_pool::parallelFor(y_size, row_cost, [&](int32_t begin, int32_t end) {
+            simple_imgproc::OrientedRowWriter writer(im_out, x_size, y_size, orientation, begin);
+            for (int32_t yy = begin; yy < end; ++yy) {
+                if (!need_horizontal) {
+                    std::memcpy(writer.row(), src.ptr<uint8_t>(yy), row_bytes);
+                } else {
+#if HAVE_WASM_SIMD
+                    resampleHorizontalRowSIMD(writer.row(), src.ptr<uint8_t>(yy), in_end, x_size, channels,
+                                              horiz->ksize, horiz->bounds.data(), horiz->kk.data(), horiz->precision);
+#else
+                    resampleHorizontalRow(writer.row(), src.ptr<uint8_t>(yy), x_size, channels,
+                                          horiz->ksize, horiz->bounds.data(), horiz->kk.data(), horiz->precision);
+#endif
+                }
+                writer.commit();
+            }
+        });
+        return im_out;
     }
     
-    // Two-pass resize: horizontal pass
+    // Horizontal pass over the source rows the vertical windows cover
+    SimpleImage im_temp;
+    const SimpleImage* im_vert = &src;
     if (need_horizontal) {
-        const int32_t ybox_first = need_vertical ? bounds_vert[0] : 0;
-        const int32_t ybox_last = need_vertical ? 
-            bounds_vert[y_size * 2 - 2] + bounds_vert[y_size * 2 - 1] : 
-            src.rows();
+        const int32_t ybox_first = bounds_vert[0];
+        const int32_t ybox_last = bounds_vert[y_size * 2 - 2] + bounds_vert[y_size * 2 - 1];
         
         // Shift bounds for vertical pass
-        if (need_vertical) {
-            for (int32_t i = 0; i < y_size; ++i) {
-                bounds_vert[i * 2] -= ybox_first;
-            }
+        for (int32_t i = 0; i < y_size; ++i) {
+            bounds_vert[i * 2] -= ybox_first;
         }
         
         // Create destination image with desired output width
-        im_temp.create(ybox_last - ybox_first, x_size, src.channels());
+        im_temp.create(ybox_last - ybox_first, x_size, channels, src.pixelFormat());
         if (!im_temp.empty()) {
 #if HAVE_WASM_SIMD
-            resampleHorizontalSIMD(im_temp, src, ybox_first, ksize_horiz, bounds_horiz, kk_horiz);
+            resampleHorizontalSIMD(im_temp, src, ybox_first, horiz->ksize, horiz->bounds, horiz->kk, horiz->precision);
 #else
-            resampleHorizontal<uint8_t>(im_temp, src, ybox_first, ksize_horiz, bounds_horiz, kk_horiz);
+            resampleHorizontal<uint8_t>(im_temp, src, ybox_first, horiz->ksize, horiz->bounds, horiz->kk, horiz->precision);
 #endif
         } else {
             throw std::runtime_error("Failed to allocate temporary image");
         }
-    } else {
-        im_temp = src; // No horizontal resizing needed
+        im_vert = &im_temp;
     }
     
     // Vertical pass
-    if (need_vertical) {
-        if (need_horizontal) {
-            // Use horizontally resized image
-            im_out.create(y_size, x_size, src.channels());
-            if (!im_out.empty()) {
+    const int32_t ksize = vert->ksize;
+    thread_pool::parallelFor(y_size, static_cast<int64_t>(row_bytes) * ksize, [&](int32_t begin, int32_t end) {
+        simple_imgproc::OrientedRowWriter writer(im_out, x_size, y_size, orientation, begin);
+        std::vector<const uint8_t*> rows(ksize);
+        for (int32_t yy = begin; yy < end; ++yy) {
+            const int32_t ymin = bounds_vert[yy * 2 + 0];
+            const int32_t ymax = bounds_vert[yy * 2 + 1];
+            for (int32_t y = 0; y < ymax; ++y) {
+                rows[y] = im_vert->ptr<uint8_t>(ymin + y);
+            }
 #if HAVE_WASM_SIMD
-                resampleVerticalSIMD(im_out, im_temp, 0, ksize_vert, bounds_vert, kk_vert);
+            resampleVerticalRowSIMD(writer.row(), rows.data(), row_bytes, ymax, &vert->kk[yy * ksize], vert->precision);
 #else
-                resampleVertical<uint8_t>(im_out, im_temp, 0, ksize_vert, bounds_vert, kk_vert);
+            resampleVerticalRow(writer.row(), rows.data(), row_bytes, ymax, &vert->kk[yy * ksize], vert->precision);
 #endif
-            } else {
-                throw std::runtime_error("Failed to allocate output image");
-            }
-        } else {
-            // Use original image for vertical-only resize
-            im_out.create(y_size, x_size, src.channels());
-            if (!im_out.empty()) {
+            writer.commit();
+        }
+    });
+    
+    return im_out;
+}
+
+SimpleImage resize(const SimpleImage& src, const SimpleSize& out_size, FilterType filter_type,
+                   double reducing_gap, int orientation) {
+    if (src.empty()) {
+        return SimpleImage();
+    }
+    
+    const int32_t x_size = out_size.width;
+    const int32_t y_size = out_size.height;
+    
+    if (x_size < 1 || y_size < 1) {
+        throw std::runtime_error("Output size must be positive");
+    }
+    
+    const Filter& filter = filterFor(filter_type);
+    
+    int32_t factor_x;
+    int32_t factor_y;
+    boxReduceFactors(filter_type, reducing_gap, src.cols(), src.rows(), x_size, y_size, factor_x, factor_y);
+    if (factor_x == 1 && factor_y == 1) {
+        return resample(src, x_size, y_size, src.cols(), src.rows(), filter, orientation);
+    }
+    
+    // The reduced image covers src / factor pixels of the source area
+    const SimpleImage reduced = reduceBox(src, factor_x, factor_y);
+    return resample(reduced, x_size, y_size,
+                    static_cast<double>(src.cols()) / factor_x,
+                    static_cast<double>(src.rows()) / factor_y, filter, orientation);
+}
+
+StreamingResizer::StreamingResizer(int32_t in_width,
+                                   int32_t in_height,
+                                   int32_t channels,
+                                   const SimpleSize& out_size,
+                                   RowSink sink,
+                                   FilterType filter_type,
+                                   double reducing_gap,
+                                   double box_x,
+                                   double box_y,
+                                   double box_width,
+                                   double box_height)
+    : m_in_height(in_height),
+      m_channels(channels),
+      m_out_width(out_size.width),
+      m_out_height(out_size.height),
+      m_resample_width(in_width),
+      m_sink(std::move(sink)) {
+    if (m_out_width < 1 || m_out_height < 1) {
+        throw std::runtime_error("Output size must be positive");
+    }
+    
+    const size_t row_bytes = static_cast<size_t>(m_out_width) * channels;
+    m_line.resize(row_bytes);
+    
+    // Same reduction as resize(); the passes below then see the reduced rows
+    int32_t factor_x;
+    int32_t factor_y;
+    boxReduceFactors(filter_type, reducing_gap, in_width, in_height, m_out_width, m_out_height, factor_x, factor_y);
+    int32_t resample_height = in_height;
+    if (box_width <= 0.0) {
+        box_width = in_width;
+    }
+    if (box_height <= 0.0) {
+        box_height = in_height;
+    }
+    if (factor_x > 1 || factor_y > 1) {
+        m_box.reset(new BoxReducer(in_width, channels, factor_x, factor_y));
+        m_resample_width = m_box->outWidth();
+        m_reduced.resize(static_cast<size_t>(m_resample_width) * channels);
+        resample_height = (in_height + factor_y - 1) / factor_y;
+        box_x /= factor_x;
+        box_y /= factor_y;
+        box_width /= factor_x;
+        box_height /= factor_y;
+    }
+    
+    m_need_horizontal = m_out_width != m_resample_width || box_x != 0.0 || box_width != m_resample_width;
+    m_need_vertical = m_out_height != resample_height || box_y != 0.0 || box_height != resample_height;
+    
+    const Filter& filter = filterFor(filter_type);
+    
+    if (m_need_horizontal) {
+        m_horiz = getCoeffs(m_resample_width, box_x, box_x + box_width, m_out_width, filter);
+    }
+    
+    if (m_need_vertical) {
+        m_vert = getCoeffs(resample_height, box_y, box_y + box_height, m_out_height, filter);
+        
+        // Windows only move forward, so ksize_vert rows always cover the
+        // window of the next pending output row
+        m_ring.resize(row_bytes * m_vert->ksize);
+        m_rows.resize(m_vert->ksize);
+    }
+}
+
+void StreamingResizer::resampleRowHorizontal(uint8_t* out, const uint8_t* in) const {
 #if HAVE_WASM_SIMD
-                resampleVerticalSIMD(im_out, src, 0, ksize_vert, bounds_vert, kk_vert);
+    resampleHorizontalRowSIMD(out, in, in + static_cast<size_t>(m_resample_width) * m_channels,
+                              m_out_width, m_channels, m_horiz->ksize,
+                              m_horiz->bounds.data(), m_horiz->kk.data(), m_horiz->precision);
 #else
-                resampleVertical<uint8_t>(im_out, src, 0, ksize_vert, bounds_vert, kk_vert);
+    resampleHorizontalRow(out, in, m_out_width, m_channels, m_horiz->ksize,
+                          m_horiz->bounds.data(), m_horiz->kk.data(), m_horiz->precision);
 #endif
-            } else {
-                throw std::runtime_error("Failed to allocate output image");
-            }
+}
+
+void StreamingResizer::pushRow(const uint8_t* row) {
+    const int32_t y = m_in_y++;
+    if (done()) {
+        return;
+    }
+    
+    if (!m_box) {
+        resampleRow(row, y);
+        return;
+    }
+    
+    // The last block may be shorter than factorY() rows
+    m_box->addRow(row);
+    if (++m_box_rows == m_box->factorY() || m_in_y == m_in_height) {
+        m_box->emitRow(m_reduced.data(), m_box_rows);
+        m_box_rows = 0;
+        resampleRow(m_reduced.data(), m_box_y++);
+    }
+}
+
+void StreamingResizer::resampleRow(const uint8_t* row, int32_t y) {
+    const size_t row_bytes = m_line.size();
+    
+    if (!m_need_vertical) {
+        if (m_need_horizontal) {
+            resampleRowHorizontal(m_line.data(), row);
+            row = m_line.data();
         }
+        m_sink(row, m_out_y++);
+        return;
+    }
+    
+    // Rows above the first window do not contribute to any output row
+    const int32_t ksize_vert = m_vert->ksize;
+    const std::vector<int32_t>& bounds_vert = m_vert->bounds;
+    if (y < bounds_vert[0]) {
+        return;
+    }
+    
+    uint8_t* slot = m_ring.data() + (y % ksize_vert) * row_bytes;
+    if (m_need_horizontal) {
+        resampleRowHorizontal(slot, row);
     } else {
-        im_out = im_temp; // No vertical resizing needed
+        std::memcpy(slot, row, row_bytes);
     }
     
-    return im_out;
+    // Emit every output row whose window ends at this source row
+    while (!done()) {
+        const int32_t ymin = bounds_vert[m_out_y * 2 + 0];
+        const int32_t ymax = bounds_vert[m_out_y * 2 + 1];
+        if (ymin + ymax - 1 > y) {
+            break;
+        }
+        for (int32_t k = 0; k < ymax; ++k) {
+            m_rows[k] = m_ring.data() + ((ymin + k) % ksize_vert) * row_bytes;
+        }
+        const int16_t* k = &m_vert->kk[m_out_y * ksize_vert];
+#if HAVE_WASM_SIMD
+        resampleVerticalRowSIMD(m_line.data(), m_rows.data(), static_cast<int32_t>(row_bytes), ymax, k, m_vert->precision);
+#else
+        resampleVerticalRow(m_line.data(), m_rows.data(), static_cast<int32_t>(row_bytes), ymax, k, m_vert->precision);
+#endif
+        m_sink(m_line.data(), m_out_y++);
+    }
 }
 
 } // namespace PillowResize
@@ -2,6 +2,7 @@
 #define PILLOW_RESIZE_HPP
 
 #include "simple_image.h"
+#include <functional>
 #include <memory>
 #include <vector>
 #include <cmath>
@@ -23,8 +24,74 @@
 #endif
 
 namespace PillowResize {
+    // Resampling filters (Pillow's NEAREST, BOX, BILINEAR, BICUBIC, LANCZOS)
+    enum class FilterType {
+        Nearest,
+        Box,
+        Bilinear,
+        Bicubic,
+        Lanczos
+    };
+    
+    // Filter interface extracted from pillow-resize
+    class Filter {
+    public:
+        virtual ~Filter() = default;
+        virtual FilterType type() const = 0;
+        virtual double support() const = 0;
+        virtual double filter(double x) const = 0;
+    };
+    
+    // Single nearest source pixel; precomputeCoeffs emits one tap per output
+    class NearestFilter : public Filter {
+    public:
+        FilterType type() const override { return FilterType::Nearest; }
+        double support() const override { return 0.5; }
+        double filter(double x) const override {
+            return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+        }
+    };
+    
+    // Area average over the source footprint of each output pixel
+    class BoxFilter : public Filter {
+    public:
+        FilterType type() const override { return FilterType::Box; }
+        double support() const override { return 0.5; }
+        double filter(double x) const override {
+            return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+        }
+    };
+    
+    class BilinearFilter : public Filter {
+    public:
+        FilterType type() const override { return FilterType::Bilinear; }
+        double support() const override { return 1.0; }
+        double filter(double x) const override {
+            x = std::fabs(x);
+            return x < 1.0 ? 1.0 - x : 0.0;
+        }
+    };
+    
+    class BicubicFilter : public Filter {
+    public:
+        FilterType type() const override { return FilterType::Bicubic; }
+        double support() const override { return 2.0; }
+        double filter(double x) const override {
+            // Keys cubic with a = -0.5, as in Pillow
+            constexpr double a = -0.5;
+            x = std::fabs(x);
+            if (x < 1.0) {
+                return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+            }
+            if (x < 2.0) {
+                return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+            }
+            return 0.0;
+        }
+    };
+    
     // Lanczos filter implementation extracted from pillow-resize
-    class LanczosFilter {
+    class LanczosFilter : public Filter {
     private:
         static constexpr double lanczos_filter_support = 3.0;
         
@@ -37,9 +104,10 @@ namespace PillowResize {
         }
         
     public:
-        double support() const { return lanczos_filter_support; }
+        FilterType type() const override { return FilterType::Lanczos; }
+        double support() const override { return lanczos_filter_support; }
         
-        double filter(double x) const {
+        double filter(double x) const override {
             // Truncated sinc filter (Lanczos kernel with a = 3)
             constexpr double lanczos_a_param = 3.0;
             if (-lanczos_a_param <= x && x < lanczos_a_param) {
@@ -49,20 +117,75 @@ namespace PillowResize {
         }
     };
     
-    // Precompute coefficients for 1D interpolation
+    // Shared instance for a filter type
+    const Filter& filterFor(FilterType type);
+    
+    // Precompute coefficients for 1D interpolation (normalized, floating point)
     int32_t precomputeCoeffs(int32_t in_size,
                             double in0,
                             double in1,
                             int32_t out_size,
-                            const LanczosFilter& filter,
+                            const Filter& filter,
                             std::vector<int32_t>& bounds,
                             std::vector<double>& kk);
     
+    // Convert coefficients to int16 fixed point, returns the precision (fraction bits).
+    // Taps are rounded independently, as in Pillow-SIMD.
+    int32_t normalizeCoeffs8bpc(const std::vector<double>& prekk, std::vector<int16_t>& kk);
+    
+    // Fixed-point coefficient tables for one axis
+    struct ResampleCoeffs {
+        int32_t ksize = 0;
+        int32_t precision = 0;
+        std::vector<int32_t> bounds;
+        std::vector<int16_t> kk;
+    };
+    
+    // Coefficients for resampling [in0, in1) of an in_size axis to out_size.
+    // Tables are shared through a process-wide LRU cache, since the same
+    // geometry recurs across requests (e.g. 4032 -> 1536 for phone photos).
+    std::shared_ptr<const ResampleCoeffs> getCoeffs(int32_t in_size,
+                                                    double in0,
+                                                    double in1,
+                                                    int32_t out_size,
+                                                    const Filter& filter);
+    
+    struct CoeffCacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t limit = 0;
+    };
+    
+    CoeffCacheStats coeffCacheStats();
+    
+    // Memory cap for cached tables in bytes (0 disables caching); least recently
+    // used tables are evicted first
+    void setCoeffCacheLimit(size_t bytes);
+    
+    void clearCoeffCache();
+    
     // Optimized clipping function for 8-bit values
-    uint8_t clip8(double in);
+    uint8_t clip8(int32_t in, int32_t coefs_precision);
     
-    // SIMD-optimized clip function for multiple values
-    void clip8_simd(const double* input, uint8_t* output, int count);
+    // Resample one row horizontally (bounds/kk as returned by precomputeCoeffs)
+    void resampleHorizontalRow(uint8_t* out,
+                               const uint8_t* in,
+                               int32_t out_width,
+                               int32_t channels,
+                               int32_t ksize,
+                               const int32_t* bounds,
+                               const int16_t* kk,
+                               int32_t coefs_precision);
+    
+    // Produce one output row from ymax source rows weighted by k
+    void resampleVerticalRow(uint8_t* out,
+                             const uint8_t* const* in_rows,
+                             int32_t row_bytes,
+                             int32_t ymax,
+                             const int16_t* k,
+                             int32_t coefs_precision);
     
     // Horizontal resampling function
     template<typename T>
@@ -71,7 +194,8 @@ namespace PillowResize {
                            int32_t offset,
                            int32_t ksize,
                            const std::vector<int32_t>& bounds,
-                           const std::vector<double>& kk);
+                           const std::vector<int16_t>& kk,
+                           int32_t coefs_precision);
     
     // Vertical resampling function
     template<typename T>
@@ -80,16 +204,36 @@ namespace PillowResize {
                          int32_t offset,
                          int32_t ksize,
                          const std::vector<int32_t>& bounds,
-                         const std::vector<double>& kk);
+                         const std::vector<int16_t>& kk,
+                         int32_t coefs_precision);
 
 #if HAVE_WASM_SIMD
+    // SIMD row kernels; in_end bounds the wide loads of the horizontal kernel
+    void resampleHorizontalRowSIMD(uint8_t* out,
+                                   const uint8_t* in,
+                                   const uint8_t* in_end,
+                                   int32_t out_width,
+                                   int32_t channels,
+                                   int32_t ksize,
+                                   const int32_t* bounds,
+                                   const int16_t* kk,
+                                   int32_t coefs_precision);
+    
+    void resampleVerticalRowSIMD(uint8_t* out,
+                                 const uint8_t* const* in_rows,
+                                 int32_t row_bytes,
+                                 int32_t ymax,
+                                 const int16_t* k,
+                                 int32_t coefs_precision);
+    
     // SIMD-optimized horizontal resampling
     void resampleHorizontalSIMD(SimpleImage& im_out,
                                 const SimpleImage& im_in,
                                 int32_t offset,
                                 int32_t ksize,
                                 const std::vector<int32_t>& bounds,
-                                const std::vector<double>& kk);
+                                const std::vector<int16_t>& kk,
+                                int32_t coefs_precision);
     
     // SIMD-optimized vertical resampling
     void resampleVerticalSIMD(SimpleImage& im_out,
@@ -97,11 +241,124 @@ namespace PillowResize {
                              int32_t offset,
                              int32_t ksize,
                              const std::vector<int32_t>& bounds,
-                             const std::vector<double>& kk);
+                             const std::vector<int16_t>& kk,
+                             int32_t coefs_precision);
 #endif
     
-    // Main resize function using Lanczos resampling
-    SimpleImage resize(const SimpleImage& src, const SimpleSize& out_size);
+    // Accumulates source rows and averages factor_x x factor_y blocks into one
+    // output row. Blocks at the right edge may be narrower, and emitRow()
+    // takes the number of rows actually added for a shorter last block.
+    class BoxReducer {
+    public:
+        BoxReducer(int32_t in_width, int32_t channels, int32_t factor_x, int32_t factor_y);
+        
+        int32_t outWidth() const { return m_out_width; }
+        int32_t factorY() const { return m_factor_y; }
+        
+        void addRow(const uint8_t* row);
+        
+        // Write the block averages (outWidth() * channels bytes) and reset
+        void emitRow(uint8_t* out, int32_t rows_added);
+        
+    private:
+        int32_t m_in_width;
+        int32_t m_channels;
+        int32_t m_factor_x;
+        int32_t m_factor_y;
+        int32_t m_out_width;
+        std::vector<uint32_t> m_sums;
+    };
+    
+    // Average factor_x x factor_y blocks (Pillow's reduce()); the output is
+    // ceil(cols / factor_x) x ceil(rows / factor_y) and edge blocks average
+    // the pixels they cover
+    SimpleImage reduceBox(const SimpleImage& src, int32_t factor_x, int32_t factor_y);
+    
+    // Main resize function (Lanczos by default). Box downscales by integer
+    // ratios take the reduceBox() path.
+    //
+    // reducing_gap (Pillow's reducing_gap) enables a reduceBox() prefilter for
+    // large downscales: each axis is first reduced by an integer factor while
+    // the result stays at least reducing_gap times the output, and the filter
+    // resamples the rest. Larger values are closer to plain resampling;
+    // values below 1 disable the prefilter (default).
+    //
+    // orientation (EXIF 1-8) is applied by the last pass as it stores its
+    // rows; out_size is the size before orientation, so 5-8 return an
+    // out_size.height x out_size.width image.
+    SimpleImage resize(const SimpleImage& src, const SimpleSize& out_size,
+                       FilterType filter = FilterType::Lanczos,
+                       double reducing_gap = 0.0,
+                       int orientation = 1);
+    
+    // Row-streaming variant of resize(). Source rows are pushed top to bottom;
+    // each one goes through the horizontal pass into a ring buffer of
+    // ksize_vert rows, and an output row is handed to the sink as soon as its
+    // vertical window is complete. Memory is proportional to the output width
+    // instead of the source area. Output is identical to resize() with the
+    // same filter and reducing_gap.
+    //
+    // box_x / box_y / box_width / box_height (size 0 = the source size)
+    // resample only that area of the source. A box reaching a little past
+    // the source edges is allowed; taps outside the source are dropped.
+    // Planar YCbCr uses it to keep odd-sized chroma planes aligned with their
+    // luma plane.
+    class StreamingResizer {
+    public:
+        // row points to out_size.width * channels bytes, valid during the call
+        using RowSink = std::function<void(const uint8_t* row, int32_t y)>;
+        
+        StreamingResizer(int32_t in_width,
+                         int32_t in_height,
+                         int32_t channels,
+                         const SimpleSize& out_size,
+                         RowSink sink,
+                         FilterType filter = FilterType::Lanczos,
+                         double reducing_gap = 0.0,
+                         double box_x = 0.0,
+                         double box_y = 0.0,
+                         double box_width = 0.0,
+                         double box_height = 0.0);
+        
+        // Push the next source row (in_width * channels bytes)
+        void pushRow(const uint8_t* row);
+        
+        // All output rows have been emitted; the remaining source rows are not needed
+        bool done() const { return m_out_y >= m_out_height; }
+        
+    private:
+        void resampleRowHorizontal(uint8_t* out, const uint8_t* in) const;
+        
+        // Feed row y of the (box reduced) source to the resampling passes
+        void resampleRow(const uint8_t* row, int32_t y);
+        
+        int32_t m_in_height;
+        int32_t m_channels;
+        int32_t m_out_width;
+        int32_t m_out_height;
+        int32_t m_in_y = 0;
+        int32_t m_out_y = 0;
+        
+        bool m_need_horizontal;
+        bool m_need_vertical;
+        
+        // Box reduction in front of the resampling passes (integer box
+        // ratios and the reducing_gap prefilter)
+        std::unique_ptr<BoxReducer> m_box;
+        int32_t m_box_rows = 0;
+        int32_t m_box_y = 0;
+        int32_t m_resample_width;
+        std::vector<uint8_t> m_reduced;
+        
+        std::shared_ptr<const ResampleCoeffs> m_horiz;
+        std::shared_ptr<const ResampleCoeffs> m_vert;
+        
+        // Horizontally resampled rows, indexed by source row % m_vert->ksize
+        std::vector<uint8_t> m_ring;
+        std::vector<const uint8_t*> m_rows;
+        std::vector<uint8_t> m_line;
+        RowSink m_sink;
+    };
 }
 
 #endif // PILLOW_RESIZE_HPP
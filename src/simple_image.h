@@ -18,6 +18,20 @@ struct SimpleSize {
     SimpleSize(int w, int h) : width(w), height(h) {}
 };
 
+// Channel order of the pixel data. Decoders produce RGB / RGBA / GRAY;
+// BGR is only kept for callers that still hand over OpenCV-style buffers.
+enum class PixelFormat {
+    GRAY,
+    RGB,
+    RGBA,
+    BGR
+};
+
+// Default channel order for a channel count
+inline PixelFormat defaultPixelFormat(int channels) {
+    return channels == 1 ? PixelFormat::GRAY : channels == 4 ? PixelFormat::RGBA : PixelFormat::RGB;
+}
+
 // Simple image class to replace cv::Mat
 class SimpleImage {
 private:
@@ -25,17 +39,25 @@ private:
     int m_width;
     int m_height;
     int m_channels;
+    PixelFormat m_format;
     
 public:
-    SimpleImage() : m_width(0), m_height(0), m_channels(0) {}
+    SimpleImage() : m_width(0), m_height(0), m_channels(0), m_format(PixelFormat::RGB) {}
     
     SimpleImage(int height, int width, int channels) 
-        : m_width(width), m_height(height), m_channels(channels) {
+        : m_width(width), m_height(height), m_channels(channels),
+          m_format(defaultPixelFormat(channels)) {
+        m_data.resize(width * height * channels);
+    }
+    
+    SimpleImage(int height, int width, int channels, PixelFormat format) 
+        : m_width(width), m_height(height), m_channels(channels), m_format(format) {
         m_data.resize(width * height * channels);
     }
     
     SimpleImage(int height, int width, int channels, uint8_t* data) 
-        : m_width(width), m_height(height), m_channels(channels) {
+        : m_width(width), m_height(height), m_channels(channels),
+          m_format(defaultPixelFormat(channels)) {
         size_t size = width * height * channels;
         m_data.resize(size);
         std::memcpy(m_data.data(), data, size);
@@ -44,7 +66,11 @@ public:
     // Copy constructor
     SimpleImage(const SimpleImage& other) 
         : m_data(other.m_data), m_width(other.m_width), 
-          m_height(other.m_height), m_channels(other.m_channels) {}
+          m_height(other.m_height), m_channels(other.m_channels),
+          m_format(other.m_format) {}
+    
+    // Move constructor
+    SimpleImage(SimpleImage&& other) noexcept = default;
     
     // Assignment operator
     SimpleImage& operator=(const SimpleImage& other) {
@@ -53,10 +79,14 @@ public:
             m_width = other.m_width;
             m_height = other.m_height;
             m_channels = other.m_channels;
+            m_format = other.m_format;
         }
         return *this;
     }
     
+    // Move assignment
+    SimpleImage& operator=(SimpleImage&& other) noexcept = default;
+    
     // Clone method
     SimpleImage clone() const {
         return SimpleImage(*this);
@@ -66,6 +96,8 @@ public:
     int cols() const { return m_width; }
     int rows() const { return m_height; }
     int channels() const { return m_channels; }
+    PixelFormat pixelFormat() const { return m_format; }
+    void setPixelFormat(PixelFormat format) { m_format = format; }
     bool empty() const { return m_data.empty() || m_width == 0 || m_height == 0; }
     
     // Data access
@@ -92,9 +124,14 @@ public:
     
     // Create new image
     void create(int height, int width, int channels) {
+        create(height, width, channels, defaultPixelFormat(channels));
+    }
+    
+    void create(int height, int width, int channels, PixelFormat format) {
         m_width = width;
         m_height = height;
         m_channels = channels;
+        m_format = format;
         m_data.resize(width * height * channels);
     }
 };
@@ -1,142 +1,723 @@
 #include "simple_imgproc.h"
+#include "thread_pool.h"
 #include <algorithm>
+#include <cstring>
+
+// WASM SIMD support
+#ifdef __wasm__
+    #ifdef __wasm_simd128__
+        #include <wasm_simd128.h>
+        #define HAVE_WASM_SIMD 1
+    #else
+        #define HAVE_WASM_SIMD 0
+    #endif
+#else
+    #define HAVE_WASM_SIMD 0
+#endif
 
 namespace simple_imgproc {
 
+// Row kernels of cvtColor. The SIMD paths take 16 pixels per step and build
+// every output register from one or two two-source byte shuffles of the
+// input registers (48 bytes for 3 channels). Pixels left over at the end of a
+// row go through the scalar loop, which produces the same bytes.
+
+#if HAVE_WASM_SIMD
+// 0xFF in the alpha byte of every 32-bit pixel
+static inline v128_t opaqueMask() {
+    return wasm_i32x4_splat(static_cast<int32_t>(0xFF000000u));
+}
+#endif
+
+// RGB <-> BGR
+static void swapRedBlue3(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if HAVE_WASM_SIMD
+    for (; i + 16 <= count; i += 16) {
+        const v128_t a = wasm_v128_load(src + i * 3);
+        const v128_t b = wasm_v128_load(src + i * 3 + 16);
+        const v128_t c = wasm_v128_load(src + i * 3 + 32);
+        const v128_t o0 = wasm_i8x16_shuffle(a, b, 2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 17);
+        // Byte 17 of the output is the blue of pixel 5, the last byte of a
+        const v128_t t1 = wasm_i8x16_shuffle(b, c, 0, 0, 4, 3, 2, 7, 6, 5, 10, 9, 8, 13, 12, 11, 16, 15);
+        const v128_t o1 = wasm_i8x16_shuffle(t1, a, 0, 31, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        const v128_t o2 = wasm_i8x16_shuffle(b, c, 14, 19, 18, 17, 22, 21, 20, 25, 24, 23, 28, 27, 26, 31, 30, 29);
+        wasm_v128_store(dst + i * 3, o0);
+        wasm_v128_store(dst + i * 3 + 16, o1);
+        wasm_v128_store(dst + i * 3 + 32, o2);
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t r = src[i * 3];
+        const uint8_t g = src[i * 3 + 1];
+        const uint8_t b = src[i * 3 + 2];
+        dst[i * 3] = b;
+        dst[i * 3 + 1] = g;
+        dst[i * 3 + 2] = r;
+    }
+}
+
+// RGBA -> RGB (SWAP: -> BGR); alpha is discarded
+template<bool SWAP>
+static void dropAlpha(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if HAVE_WASM_SIMD
+    for (; i + 16 <= count; i += 16) {
+        const v128_t a = wasm_v128_load(src + i * 4);
+        const v128_t b = wasm_v128_load(src + i * 4 + 16);
+        const v128_t c = wasm_v128_load(src + i * 4 + 32);
+        const v128_t d = wasm_v128_load(src + i * 4 + 48);
+        v128_t o0, o1, o2;
+        if (SWAP) {
+            o0 = wasm_i8x16_shuffle(a, b, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 18, 17, 16, 22);
+            o1 = wasm_i8x16_shuffle(b, c, 5, 4, 10, 9, 8, 14, 13, 12, 18, 17, 16, 22, 21, 20, 26, 25);
+            o2 = wasm_i8x16_shuffle(c, d, 8, 14, 13, 12, 18, 17, 16, 22, 21, 20, 26, 25, 24, 30, 29, 28);
+        } else {
+            o0 = wasm_i8x16_shuffle(a, b, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20);
+            o1 = wasm_i8x16_shuffle(b, c, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25);
+            o2 = wasm_i8x16_shuffle(c, d, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25, 26, 28, 29, 30);
+        }
+        wasm_v128_store(dst + i * 3, o0);
+        wasm_v128_store(dst + i * 3 + 16, o1);
+        wasm_v128_store(dst + i * 3 + 32, o2);
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t r = src[i * 4];
+        const uint8_t g = src[i * 4 + 1];
+        const uint8_t b = src[i * 4 + 2];
+        dst[i * 3] = SWAP ? b : r;
+        dst[i * 3 + 1] = g;
+        dst[i * 3 + 2] = SWAP ? r : b;
+    }
+}
+
+// RGB -> RGBA (SWAP: BGR -> RGBA) with opaque alpha
+template<bool SWAP>
+static void addAlpha(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if HAVE_WASM_SIMD
+    const v128_t opaque = opaqueMask();
+    for (; i + 16 <= count; i += 16) {
+        const v128_t a = wasm_v128_load(src + i * 3);
+        const v128_t b = wasm_v128_load(src + i * 3 + 16);
+        const v128_t c = wasm_v128_load(src + i * 3 + 32);
+        v128_t o0, o1, o2, o3;
+        if (SWAP) {
+            o0 = wasm_i8x16_shuffle(a, a, 2, 1, 0, 0, 5, 4, 3, 0, 8, 7, 6, 0, 11, 10, 9, 0);
+            o1 = wasm_i8x16_shuffle(a, b, 14, 13, 12, 0, 17, 16, 15, 0, 20, 19, 18, 0, 23, 22, 21, 0);
+            o2 = wasm_i8x16_shuffle(b, c, 10, 9, 8, 0, 13, 12, 11, 0, 16, 15, 14, 0, 19, 18, 17, 0);
+            o3 = wasm_i8x16_shuffle(c, c, 6, 5, 4, 0, 9, 8, 7, 0, 12, 11, 10, 0, 15, 14, 13, 0);
+        } else {
+            o0 = wasm_i8x16_shuffle(a, a, 0, 1, 2, 0, 3, 4, 5, 0, 6, 7, 8, 0, 9, 10, 11, 0);
+            o1 = wasm_i8x16_shuffle(a, b, 12, 13, 14, 0, 15, 16, 17, 0, 18, 19, 20, 0, 21, 22, 23, 0);
+            o2 = wasm_i8x16_shuffle(b, c, 8, 9, 10, 0, 11, 12, 13, 0, 14, 15, 16, 0, 17, 18, 19, 0);
+            o3 = wasm_i8x16_shuffle(c, c, 4, 5, 6, 0, 7, 8, 9, 0, 10, 11, 12, 0, 13, 14, 15, 0);
+        }
+        wasm_v128_store(dst + i * 4, wasm_v128_or(o0, opaque));
+        wasm_v128_store(dst + i * 4 + 16, wasm_v128_or(o1, opaque));
+        wasm_v128_store(dst + i * 4 + 32, wasm_v128_or(o2, opaque));
+        wasm_v128_store(dst + i * 4 + 48, wasm_v128_or(o3, opaque));
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t c0 = src[i * 3];
+        const uint8_t c1 = src[i * 3 + 1];
+        const uint8_t c2 = src[i * 3 + 2];
+        dst[i * 4] = SWAP ? c2 : c0;
+        dst[i * 4 + 1] = c1;
+        dst[i * 4 + 2] = SWAP ? c0 : c2;
+        dst[i * 4 + 3] = 255;
+    }
+}
+
+// GRAY -> RGB / BGR
+static void grayToRGB(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if HAVE_WASM_SIMD
+    for (; i + 16 <= count; i += 16) {
+        const v128_t g = wasm_v128_load(src + i);
+        wasm_v128_store(dst + i * 3, wasm_i8x16_shuffle(g, g, 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5));
+        wasm_v128_store(dst + i * 3 + 16,
+                        wasm_i8x16_shuffle(g, g, 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10));
+        wasm_v128_store(dst + i * 3 + 32,
+                        wasm_i8x16_shuffle(g, g, 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15));
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t g = src[i];
+        dst[i * 3] = g;
+        dst[i * 3 + 1] = g;
+        dst[i * 3 + 2] = g;
+    }
+}
+
+// GRAY -> RGBA with opaque alpha
+static void grayToRGBA(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if HAVE_WASM_SIMD
+    const v128_t opaque = opaqueMask();
+    for (; i + 16 <= count; i += 16) {
+        const v128_t g = wasm_v128_load(src + i);
+        const v128_t o0 = wasm_i8x16_shuffle(g, g, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+        const v128_t o1 = wasm_i8x16_shuffle(g, g, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+        const v128_t o2 = wasm_i8x16_shuffle(g, g, 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11);
+        const v128_t o3 = wasm_i8x16_shuffle(g, g, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15);
+        wasm_v128_store(dst + i * 4, wasm_v128_or(o0, opaque));
+        wasm_v128_store(dst + i * 4 + 16, wasm_v128_or(o1, opaque));
+        wasm_v128_store(dst + i * 4 + 32, wasm_v128_or(o2, opaque));
+        wasm_v128_store(dst + i * 4 + 48, wasm_v128_or(o3, opaque));
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t g = src[i];
+        dst[i * 4] = g;
+        dst[i * 4 + 1] = g;
+        dst[i * 4 + 2] = g;
+        dst[i * 4 + 3] = 255;
+    }
+}
+
+// c * a / 255 rounded to nearest (exact for 8-bit inputs, as in Pillow)
+static inline uint8_t mulDiv255(int c, int a) {
+    const int t = c * a + 128;
+    return static_cast<uint8_t>((t + (t >> 8)) >> 8);
+}
+
+// RGBA -> premultiplied RGBA
+static void premultiplyAlpha(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if HAVE_WASM_SIMD
+    const v128_t opaque = opaqueMask();
+    const v128_t half = wasm_i16x8_splat(128);
+    for (; i + 4 <= count; i += 4) {
+        const v128_t v = wasm_v128_load(src + i * 4);
+        // Alpha broadcast to the color bytes; the alpha byte is scaled by 255
+        const v128_t a = wasm_i8x16_shuffle(v, opaque, 3, 3, 3, 19, 7, 7, 7, 23, 11, 11, 11, 27, 15, 15, 15, 31);
+        v128_t lo = wasm_i16x8_add(wasm_u16x8_extmul_low_u8x16(v, a), half);
+        v128_t hi = wasm_i16x8_add(wasm_u16x8_extmul_high_u8x16(v, a), half);
+        lo = wasm_u16x8_shr(wasm_i16x8_add(lo, wasm_u16x8_shr(lo, 8)), 8);
+        hi = wasm_u16x8_shr(wasm_i16x8_add(hi, wasm_u16x8_shr(hi, 8)), 8);
+        wasm_v128_store(dst + i * 4, wasm_u8x16_narrow_i16x8(lo, hi));
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t a = src[i * 4 + 3];
+        dst[i * 4] = mulDiv255(src[i * 4], a);
+        dst[i * 4 + 1] = mulDiv255(src[i * 4 + 1], a);
+        dst[i * 4 + 2] = mulDiv255(src[i * 4 + 2], a);
+        dst[i * 4 + 3] = a;
+    }
+}
+
+// c * 255 / a rounded to nearest and clipped; transparent pixels become 0
+static inline uint8_t unpremultiplyChannel(int c, int a) {
+    return a == 0 ? 0 : static_cast<uint8_t>(std::min(255, (c * 255 + a / 2) / a));
+}
+
+#if HAVE_WASM_SIMD
+// One 32-bit lane group of unpremultiplyAlpha: round(c * 255 / a) in float
+// (exact for 8-bit inputs), clipped to 255
+static inline v128_t unpremultiplyLanes(v128_t c, v128_t a) {
+    const v128_t q = wasm_f32x4_div(wasm_f32x4_mul(wasm_f32x4_convert_i32x4(c), wasm_f32x4_splat(255.0f)),
+                                    wasm_f32x4_convert_i32x4(a));
+    return wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_min(wasm_f32x4_add(q, wasm_f32x4_splat(0.5f)),
+                                                     wasm_f32x4_splat(255.0f)));
+}
+#endif
+
+// Premultiplied RGBA -> RGBA
+static void unpremultiplyAlpha(const uint8_t* src, uint8_t* dst, int count) {
+    int i = 0;
+#if HAVE_WASM_SIMD
+    const v128_t opaque = opaqueMask();
+    const v128_t zero = wasm_i32x4_splat(0);
+    for (; i + 4 <= count; i += 4) {
+        const v128_t v = wasm_v128_load(src + i * 4);
+        const v128_t a = wasm_i8x16_shuffle(v, v, 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+        const v128_t v_lo = wasm_u16x8_extend_low_u8x16(v);
+        const v128_t v_hi = wasm_u16x8_extend_high_u8x16(v);
+        const v128_t a_lo = wasm_u16x8_extend_low_u8x16(a);
+        const v128_t a_hi = wasm_u16x8_extend_high_u8x16(a);
+        const v128_t p0 = unpremultiplyLanes(wasm_u32x4_extend_low_u16x8(v_lo), wasm_u32x4_extend_low_u16x8(a_lo));
+        const v128_t p1 = unpremultiplyLanes(wasm_u32x4_extend_high_u16x8(v_lo), wasm_u32x4_extend_high_u16x8(a_lo));
+        const v128_t p2 = unpremultiplyLanes(wasm_u32x4_extend_low_u16x8(v_hi), wasm_u32x4_extend_low_u16x8(a_hi));
+        const v128_t p3 = unpremultiplyLanes(wasm_u32x4_extend_high_u16x8(v_hi), wasm_u32x4_extend_high_u16x8(a_hi));
+        v128_t out = wasm_u8x16_narrow_i16x8(wasm_i16x8_narrow_i32x4(p0, p1), wasm_i16x8_narrow_i32x4(p2, p3));
+        // Transparent pixels (a / 0) become 0, the alpha byte is kept as is
+        out = wasm_v128_andnot(out, wasm_i8x16_eq(a, zero));
+        wasm_v128_store(dst + i * 4, wasm_v128_bitselect(v, out, opaque));
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t a = src[i * 4 + 3];
+        dst[i * 4] = unpremultiplyChannel(src[i * 4], a);
+        dst[i * 4 + 1] = unpremultiplyChannel(src[i * 4 + 1], a);
+        dst[i * 4 + 2] = unpremultiplyChannel(src[i * 4 + 2], a);
+        dst[i * 4 + 3] = a;
+    }
+}
+
+// Premultiplied RGBA over an opaque background -> RGB: c + bg * (255 - a) / 255
+static void compositeOver(const uint8_t* src, uint8_t* dst, int count, const uint8_t background[3]) {
+    int i = 0;
+#if HAVE_WASM_SIMD
+    const v128_t bg = wasm_i32x4_splat(static_cast<int32_t>(background[0] | background[1] << 8 | background[2] << 16));
+    const v128_t half = wasm_i16x8_splat(128);
+    const v128_t ones = wasm_i8x16_splat(-1);
+    v128_t blended[4];
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 4; j++) {
+            const v128_t v = wasm_v128_load(src + i * 4 + j * 16);
+            // 255 - a broadcast to the color bytes (the alpha byte of bg is 0)
+            const v128_t inv = wasm_v128_xor(
+                wasm_i8x16_shuffle(v, v, 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15), ones);
+            v128_t lo = wasm_i16x8_add(wasm_u16x8_extmul_low_u8x16(bg, inv), half);
+            v128_t hi = wasm_i16x8_add(wasm_u16x8_extmul_high_u8x16(bg, inv), half);
+            lo = wasm_u16x8_shr(wasm_i16x8_add(lo, wasm_u16x8_shr(lo, 8)), 8);
+            hi = wasm_u16x8_shr(wasm_i16x8_add(hi, wasm_u16x8_shr(hi, 8)), 8);
+            blended[j] = wasm_u8x16_add_sat(v, wasm_u8x16_narrow_i16x8(lo, hi));
+        }
+        // Same byte selection as dropAlpha<false>
+        const v128_t a = blended[0], b = blended[1], c = blended[2], d = blended[3];
+        wasm_v128_store(dst + i * 3, wasm_i8x16_shuffle(a, b, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20));
+        wasm_v128_store(dst + i * 3 + 16,
+                        wasm_i8x16_shuffle(b, c, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25));
+        wasm_v128_store(dst + i * 3 + 32,
+                        wasm_i8x16_shuffle(c, d, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25, 26, 28, 29, 30));
+    }
+#endif
+    for (; i < count; i++) {
+        const int inv = 255 - src[i * 4 + 3];
+        for (int c = 0; c < 3; c++) {
+            dst[i * 3 + c] = static_cast<uint8_t>(std::min(255, src[i * 4 + c] + mulDiv255(background[c], inv)));
+        }
+    }
+}
+
+void compositeRow(const uint8_t* src, uint8_t* dst, int count, const uint8_t background[3]) {
+    compositeOver(src, dst, count, background);
+}
+
+void composite(const SimpleImage& src, SimpleImage& dst, const uint8_t background[3]) {
+    if (src.channels() != 4) return;
+
+    const int rows = src.rows();
+    const int cols = src.cols();
+    dst.create(rows, cols, SIMPLE_8UC3, PixelFormat::RGB);
+    thread_pool::parallelFor(rows, static_cast<int64_t>(cols) * 4, [&](int32_t begin, int32_t end) {
+        for (int i = begin; i < end; i++) {
+            compositeOver(src.ptr<uint8_t>(i), dst.ptr<uint8_t>(i), cols, background);
+        }
+    });
+}
+
+bool isOpaque(const SimpleImage& image) {
+    if (image.channels() != 4) return true;
+
+    const uint8_t* data = image.data();
+    const size_t count = static_cast<size_t>(image.rows()) * image.cols();
+    size_t i = 0;
+#if HAVE_WASM_SIMD
+    // 16 pixels per step; stops at the first block with a non-opaque pixel
+    const v128_t opaque = opaqueMask();
+    for (; i + 16 <= count; i += 16) {
+        const v128_t v = wasm_v128_and(wasm_v128_and(wasm_v128_load(data + i * 4), wasm_v128_load(data + i * 4 + 16)),
+                                       wasm_v128_and(wasm_v128_load(data + i * 4 + 32),
+                                                     wasm_v128_load(data + i * 4 + 48)));
+        if (wasm_v128_any_true(wasm_v128_andnot(opaque, v))) {
+            return false;
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        if (data[i * 4 + 3] != 255) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int srcChannels(ColorConversion conversion) {
+    switch (conversion) {
+        case RGBA2BGR:
+        case RGBA2RGB:
+        case RGBA2mRGBA:
+        case mRGBA2RGBA:
+            return 4;
+        case GRAY2BGR:
+        case GRAY2RGB:
+        case GRAY2RGBA:
+            return 1;
+        default:
+            return 3;
+    }
+}
+
+int dstChannels(ColorConversion conversion) {
+    switch (conversion) {
+        case RGB2RGBA:
+        case BGR2RGBA:
+        case GRAY2RGBA:
+        case RGBA2mRGBA:
+        case mRGBA2RGBA:
+            return 4;
+        default:
+            return 3;
+    }
+}
+
+void cvtColorRow(const uint8_t* src, uint8_t* dst, int count, ColorConversion conversion) {
+    switch (conversion) {
+        case RGB2BGR:
+        case BGR2RGB:
+            swapRedBlue3(src, dst, count);
+            break;
+        case RGBA2BGR:
+            dropAlpha<true>(src, dst, count);
+            break;
+        case RGBA2RGB:
+            dropAlpha<false>(src, dst, count);
+            break;
+        case RGB2RGBA:
+            addAlpha<false>(src, dst, count);
+            break;
+        case BGR2RGBA:
+            addAlpha<true>(src, dst, count);
+            break;
+        case GRAY2BGR:
+        case GRAY2RGB:
+            grayToRGB(src, dst, count);
+            break;
+        case GRAY2RGBA:
+            grayToRGBA(src, dst, count);
+            break;
+        case RGBA2mRGBA:
+            premultiplyAlpha(src, dst, count);
+            break;
+        case mRGBA2RGBA:
+            unpremultiplyAlpha(src, dst, count);
+            break;
+    }
+}
+
 void cvtColor(const SimpleImage& src, SimpleImage& dst, ColorConversion conversion) {
-    int rows = src.rows();
-    int cols = src.cols();
-    
+    if (src.channels() != srcChannels(conversion)) return;
+
+    PixelFormat format;
     switch (conversion) {
         case RGB2BGR:
-        case BGR2RGB: {
-            // RGB <-> BGR swap (same operation)
-            if (src.channels() != 3) return;
-            
-            dst.create(rows, cols, SIMPLE_8UC3);
-            
-            for (int i = 0; i < rows; i++) {
-                const uint8_t* src_row = src.ptr<uint8_t>(i);
-                uint8_t* dst_row = dst.ptr<uint8_t>(i);
-                
-                for (int j = 0; j < cols; j++) {
-                    int idx = j * 3;
-                    dst_row[idx] = src_row[idx + 2];     // R <-> B
-                    dst_row[idx + 1] = src_row[idx + 1]; // G stays
-                    dst_row[idx + 2] = src_row[idx];     // B <-> R
-                }
-            }
+        case RGBA2BGR:
+        case GRAY2BGR:
+            format = PixelFormat::BGR;
+            break;
+        case BGR2RGB:
+        case RGBA2RGB:
+        case GRAY2RGB:
+            format = PixelFormat::RGB;
+            break;
+        default:
+            format = PixelFormat::RGBA;
             break;
+    }
+
+    const int rows = src.rows();
+    const int cols = src.cols();
+    const int channels = dstChannels(conversion);
+    dst.create(rows, cols, channels == 4 ? SIMPLE_8UC4 : SIMPLE_8UC3, format);
+
+    thread_pool::parallelFor(rows, static_cast<int64_t>(cols) * channels, [&](int32_t begin, int32_t end) {
+        for (int i = begin; i < end; i++) {
+            cvtColorRow(src.ptr<uint8_t>(i), dst.ptr<uint8_t>(i), cols, conversion);
         }
-        
-        case RGBA2BGR: {
-            if (src.channels() != 4) return;
-            
-            dst.create(rows, cols, SIMPLE_8UC3);
-            
-            for (int i = 0; i < rows; i++) {
-                const uint8_t* src_row = src.ptr<uint8_t>(i);
-                uint8_t* dst_row = dst.ptr<uint8_t>(i);
-                
-                for (int j = 0; j < cols; j++) {
-                    int src_idx = j * 4;
-                    int dst_idx = j * 3;
-                    dst_row[dst_idx] = src_row[src_idx + 2];     // R -> B
-                    dst_row[dst_idx + 1] = src_row[src_idx + 1]; // G -> G
-                    dst_row[dst_idx + 2] = src_row[src_idx];     // B -> R
-                    // Alpha channel is discarded
-                }
-            }
+    });
+}
+
+void rotate(const SimpleImage& src, SimpleImage& dst, RotationType rotation) {
+    switch (rotation) {
+        case ROTATE_90_CLOCKWISE:
+            orient(src, dst, 6);
+            break;
+        case ROTATE_180:
+            orient(src, dst, 3);
+            break;
+        case ROTATE_90_COUNTERCLOCKWISE:
+            orient(src, dst, 8);
             break;
+    }
+}
+
+// Rows collected per block by OrientedRowWriter for transposing orientations
+constexpr int oriented_block_rows = 16;
+
+bool isTransposed(int orientation) {
+    return orientation >= 5 && orientation <= 8;
+}
+
+SimpleSize orientedSize(int width, int height, int orientation) {
+    return isTransposed(orientation) ? SimpleSize(height, width) : SimpleSize(width, height);
+}
+
+template<int CHANNELS>
+static void reversePixels(uint8_t* row, int width) {
+    for (int i = 0, j = width - 1; i < j; i++, j--) {
+        for (int c = 0; c < CHANNELS; c++) {
+            std::swap(row[i * CHANNELS + c], row[j * CHANNELS + c]);
         }
-        
-        case GRAY2BGR: {
-            if (src.channels() != 1) return;
-            
-            dst.create(rows, cols, SIMPLE_8UC3);
-            
-            for (int i = 0; i < rows; i++) {
-                const uint8_t* src_row = src.ptr<uint8_t>(i);
-                uint8_t* dst_row = dst.ptr<uint8_t>(i);
-                
-                for (int j = 0; j < cols; j++) {
-                    uint8_t gray_val = src_row[j];
-                    int idx = j * 3;
-                    dst_row[idx] = gray_val;     // B
-                    dst_row[idx + 1] = gray_val; // G
-                    dst_row[idx + 2] = gray_val; // R
-                }
+    }
+}
+
+static void reversePixels(uint8_t* row, int width, int channels) {
+    switch (channels) {
+        case 1: reversePixels<1>(row, width); break;
+        case 3: reversePixels<3>(row, width); break;
+        case 4: reversePixels<4>(row, width); break;
+        default:
+            for (int i = 0, j = width - 1; i < j; i++, j--) {
+                std::swap_ranges(row + i * channels, row + (i + 1) * channels, row + j * channels);
             }
             break;
+    }
+}
+
+// Tiles of transpose_tile x transpose_tile pixels keep both the source rows
+// and the destination rows of a tile in cache
+constexpr int transpose_tile = 16;
+
+#if HAVE_WASM_SIMD
+static inline v128_t interleaveLow8(v128_t a, v128_t b) {
+    return wasm_i8x16_shuffle(a, b, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+}
+
+static inline v128_t interleaveHigh8(v128_t a, v128_t b) {
+    return wasm_i8x16_shuffle(a, b, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+}
+
+// Transpose 16 rows of 16 bytes in place. Every round interleaves row i with
+// row i + 8 (a perfect shuffle); after four rounds row j holds byte j of
+// every input row.
+static inline void transpose16x16(v128_t* r) {
+    v128_t t[16];
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 8; i++) {
+            t[2 * i] = interleaveLow8(r[i], r[i + 8]);
+            t[2 * i + 1] = interleaveHigh8(r[i], r[i + 8]);
         }
+        std::copy(t, t + 16, r);
     }
 }
 
-void rotate(const SimpleImage& src, SimpleImage& dst, RotationType rotation) {
-    int src_rows = src.rows();
-    int src_cols = src.cols();
-    int channels = src.channels();
-    
-    switch (rotation) {
-        case ROTATE_90_CLOCKWISE: {
-            dst.create(src_cols, src_rows, channels);
-            
-            for (int i = 0; i < src_rows; i++) {
-                const uint8_t* src_row = src.ptr<uint8_t>(i);
-                for (int j = 0; j < src_cols; j++) {
-                    // Correct transformation: (i,j) -> (j, src_rows-1-i)
-                    int dst_row = j;
-                    int dst_col = src_rows - 1 - i;
-                    uint8_t* dst_pixel = dst.ptr<uint8_t>(dst_row) + dst_col * channels;
-                    const uint8_t* src_pixel = src_row + j * channels;
-                    
-                    for (int c = 0; c < channels; c++) {
-                        dst_pixel[c] = src_pixel[c];
-                    }
+// Same for 4 rows of four 32-bit pixels (two rounds)
+static inline void transpose4x4(v128_t* r) {
+    for (int round = 0; round < 2; round++) {
+        const v128_t t0 = wasm_i32x4_shuffle(r[0], r[2], 0, 4, 1, 5);
+        const v128_t t1 = wasm_i32x4_shuffle(r[0], r[2], 2, 6, 3, 7);
+        const v128_t t2 = wasm_i32x4_shuffle(r[1], r[3], 0, 4, 1, 5);
+        const v128_t t3 = wasm_i32x4_shuffle(r[1], r[3], 2, 6, 3, 7);
+        r[0] = t0;
+        r[1] = t1;
+        r[2] = t2;
+        r[3] = t3;
+    }
+}
+
+// 4 RGB pixels (exactly 12 bytes) widened to 32-bit lanes and back
+static inline v128_t loadRGBx4(const uint8_t* p) {
+    const v128_t v = wasm_i64x2_shuffle(wasm_v128_load64_zero(p), wasm_v128_load32_zero(p + 8), 0, 2);
+    return wasm_i8x16_shuffle(v, v, 0, 1, 2, 12, 3, 4, 5, 12, 6, 7, 8, 12, 9, 10, 11, 12);
+}
+
+static inline void storeRGBx4(uint8_t* p, v128_t v) {
+    const v128_t packed = wasm_i8x16_shuffle(v, v, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0, 0, 0, 0);
+    wasm_v128_store64_lane(p, packed, 0);
+    wasm_v128_store32_lane(p + 8, packed, 2);
+}
+#endif
+
+// dst_rows[j][dst_x + i] = src_rows[i][src_x + j] for pixel i < rows, j < cols.
+// 1-channel tiles go through 16x16 byte transposes and 3/4-channel tiles
+// through 4x4 pixel transposes; edges that do not fill a block are scalar.
+template<int CHANNELS>
+static void transposeTile(const uint8_t* const* src_rows, int src_x, uint8_t* const* dst_rows, int dst_x,
+                          int rows, int cols, int channels) {
+    const int ch = CHANNELS > 0 ? CHANNELS : channels;
+    int rows_simd = 0;
+    int cols_simd = 0;
+#if HAVE_WASM_SIMD
+    if (CHANNELS == 1) {
+        rows_simd = rows & ~15;
+        cols_simd = cols & ~15;
+        v128_t r[16];
+        for (int i0 = 0; i0 < rows_simd; i0 += 16) {
+            for (int j0 = 0; j0 < cols_simd; j0 += 16) {
+                for (int i = 0; i < 16; i++) {
+                    r[i] = wasm_v128_load(src_rows[i0 + i] + src_x + j0);
+                }
+                transpose16x16(r);
+                for (int j = 0; j < 16; j++) {
+                    wasm_v128_store(dst_rows[j0 + j] + dst_x + i0, r[j]);
                 }
             }
-            break;
         }
-        
-        case ROTATE_180: {
-            dst.create(src_rows, src_cols, channels);
-            
-            for (int i = 0; i < src_rows; i++) {
-                const uint8_t* src_row = src.ptr<uint8_t>(i);
-                uint8_t* dst_row = dst.ptr<uint8_t>(src_rows - 1 - i);
-                
-                for (int j = 0; j < src_cols; j++) {
-                    const uint8_t* src_pixel = src_row + j * channels;
-                    uint8_t* dst_pixel = dst_row + (src_cols - 1 - j) * channels;
-                    
-                    for (int c = 0; c < channels; c++) {
-                        dst_pixel[c] = src_pixel[c];
+    } else if (CHANNELS == 3 || CHANNELS == 4) {
+        rows_simd = rows & ~3;
+        cols_simd = cols & ~3;
+        v128_t r[4];
+        for (int i0 = 0; i0 < rows_simd; i0 += 4) {
+            for (int j0 = 0; j0 < cols_simd; j0 += 4) {
+                for (int i = 0; i < 4; i++) {
+                    const uint8_t* p = src_rows[i0 + i] + (src_x + j0) * CHANNELS;
+                    r[i] = CHANNELS == 4 ? wasm_v128_load(p) : loadRGBx4(p);
+                }
+                transpose4x4(r);
+                for (int j = 0; j < 4; j++) {
+                    uint8_t* p = dst_rows[j0 + j] + (dst_x + i0) * CHANNELS;
+                    if (CHANNELS == 4) {
+                        wasm_v128_store(p, r[j]);
+                    } else {
+                        storeRGBx4(p, r[j]);
                     }
                 }
             }
-            break;
         }
-        
-        case ROTATE_90_COUNTERCLOCKWISE: {
-            dst.create(src_cols, src_rows, channels);
-            
-            for (int i = 0; i < src_rows; i++) {
-                const uint8_t* src_row = src.ptr<uint8_t>(i);
-                for (int j = 0; j < src_cols; j++) {
-                    // Correct transformation: (i,j) -> (src_cols-1-j, i)
-                    int dst_row = src_cols - 1 - j;
-                    int dst_col = i;
-                    uint8_t* dst_pixel = dst.ptr<uint8_t>(dst_row) + dst_col * channels;
-                    const uint8_t* src_pixel = src_row + j * channels;
-                    
-                    for (int c = 0; c < channels; c++) {
-                        dst_pixel[c] = src_pixel[c];
-                    }
-                }
+    }
+#endif
+    for (int j = 0; j < cols; j++) {
+        uint8_t* d = dst_rows[j] + dst_x * ch;
+        for (int i = j < cols_simd ? rows_simd : 0; i < rows; i++) {
+            const uint8_t* pixel = src_rows[i] + (src_x + j) * ch;
+            for (int c = 0; c < ch; c++) {
+                d[i * ch + c] = pixel[c];
             }
-            break;
         }
     }
 }
 
+// Store rows [y0, y0 + count) of a width x height image (rows[k] is row
+// y0 + k) to dst at a transposing orientation: stored pixel (x, y) goes to
+// dst row x (W-1-x for 7/8) and column y (H-1-y for 6/7).
+template<int CHANNELS>
+static void storeTransposedRows(SimpleImage& dst, const uint8_t* const* rows, int y0, int count,
+                                int width, int height, int orientation, int channels) {
+    const bool flip_rows = orientation == 7 || orientation == 8;
+    const bool flip_cols = orientation == 6 || orientation == 7;
+    const int col0 = flip_cols ? height - y0 - count : y0;
+
+    const uint8_t* src_rows[transpose_tile];
+    uint8_t* dst_rows[transpose_tile];
+    for (int r0 = 0; r0 < count; r0 += transpose_tile) {
+        // Flipped columns take the rows bottom-up so destination columns increase
+        const int n = std::min(transpose_tile, count - r0);
+        for (int i = 0; i < n; i++) {
+            src_rows[i] = rows[flip_cols ? count - 1 - (r0 + i) : r0 + i];
+        }
+        for (int x0 = 0; x0 < width; x0 += transpose_tile) {
+            const int m = std::min(transpose_tile, width - x0);
+            for (int j = 0; j < m; j++) {
+                dst_rows[j] = dst.ptr<uint8_t>(flip_rows ? width - 1 - (x0 + j) : x0 + j);
+            }
+            transposeTile<CHANNELS>(src_rows, x0, dst_rows, col0 + r0, n, m, channels);
+        }
+    }
+}
+
+static void storeTransposedRows(SimpleImage& dst, const uint8_t* const* rows, int y0, int count,
+                                int width, int height, int orientation) {
+    switch (dst.channels()) {
+        case 1:
+            storeTransposedRows<1>(dst, rows, y0, count, width, height, orientation, 1);
+            break;
+        case 3:
+            storeTransposedRows<3>(dst, rows, y0, count, width, height, orientation, 3);
+            break;
+        case 4:
+            storeTransposedRows<4>(dst, rows, y0, count, width, height, orientation, 4);
+            break;
+        default:
+            storeTransposedRows<0>(dst, rows, y0, count, width, height, orientation, dst.channels());
+            break;
+    }
+}
+
+OrientedRowWriter::OrientedRowWriter(SimpleImage& dst, int width, int height, int orientation, int first_row)
+    : m_dst(dst),
+      m_width(width),
+      m_height(height),
+      m_channels(dst.channels()),
+      m_orientation(orientation >= 1 && orientation <= 8 ? orientation : 1),
+      m_y(first_row) {
+    if (isTransposed(m_orientation)) {
+        m_block.resize(static_cast<size_t>(oriented_block_rows) * width * m_channels);
+    }
+}
+
+uint8_t* OrientedRowWriter::row() {
+    switch (m_orientation) {
+        case 3:
+        case 4:
+            return m_dst.ptr<uint8_t>(m_height - 1 - m_y);
+        case 5:
+        case 6:
+        case 7:
+        case 8:
+            return m_block.data() + static_cast<size_t>(m_block_rows) * m_width * m_channels;
+        default:
+            return m_dst.ptr<uint8_t>(m_y);
+    }
+}
+
+void OrientedRowWriter::commit() {
+    if (m_orientation == 2 || m_orientation == 3) {
+        reversePixels(row(), m_width, m_channels);
+    }
+    m_y++;
+    if (!m_block.empty() && ++m_block_rows == oriented_block_rows) {
+        flush();
+    }
+}
+
+void OrientedRowWriter::flush() {
+    if (m_block_rows == 0) {
+        return;
+    }
+    const size_t row_bytes = static_cast<size_t>(m_width) * m_channels;
+    const uint8_t* rows[oriented_block_rows];
+    for (int i = 0; i < m_block_rows; i++) {
+        rows[i] = m_block.data() + i * row_bytes;
+    }
+    storeTransposedRows(m_dst, rows, m_y - m_block_rows, m_block_rows, m_width, m_height, m_orientation);
+    m_block_rows = 0;
+}
+
+void orient(const SimpleImage& src, SimpleImage& dst, int orientation) {
+    const SimpleSize size = orientedSize(src.cols(), src.rows(), orientation);
+    dst.create(size.height, size.width, src.channels(), src.pixelFormat());
+
+    const size_t row_bytes = static_cast<size_t>(src.cols()) * src.channels();
+    if (isTransposed(orientation)) {
+        // Tiles straight from the source rows, bands of transpose_tile rows
+        const int bands = (src.rows() + transpose_tile - 1) / transpose_tile;
+        thread_pool::parallelFor(bands, static_cast<int64_t>(row_bytes) * transpose_tile, [&](int32_t begin, int32_t end) {
+            const uint8_t* rows[transpose_tile];
+            for (int band = begin; band < end; band++) {
+                const int y0 = band * transpose_tile;
+                const int count = std::min(transpose_tile, src.rows() - y0);
+                for (int i = 0; i < count; i++) {
+                    rows[i] = src.ptr<uint8_t>(y0 + i);
+                }
+                storeTransposedRows(dst, rows, y0, count, src.cols(), src.rows(), orientation);
+            }
+        });
+        return;
+    }
+
+    thread_pool::parallelFor(src.rows(), static_cast<int64_t>(row_bytes), [&](int32_t begin, int32_t end) {
+        OrientedRowWriter writer(dst, src.cols(), src.rows(), orientation, begin);
+        for (int i = begin; i < end; i++) {
+            std::memcpy(writer.row(), src.ptr<uint8_t>(i), row_bytes);
+            writer.commit();
+        }
+    });
+}
+
 } // namespace simple_imgproc
\ No newline at end of file
@@ -3,15 +3,23 @@
 
 #include "simple_image.h"
 #include <cstdint>
+#include <vector>
 
 namespace simple_imgproc {
 
-// Color conversion types
+// Color conversion types (mRGBA is RGBA with premultiplied alpha)
 enum ColorConversion {
     RGB2BGR,
     BGR2RGB,
     RGBA2BGR,
-    GRAY2BGR
+    GRAY2BGR,
+    RGBA2RGB,
+    RGB2RGBA,
+    BGR2RGBA,
+    GRAY2RGB,
+    GRAY2RGBA,
+    RGBA2mRGBA,
+    mRGBA2RGBA
 };
 
 // Rotation types
@@ -24,9 +32,64 @@ enum RotationType {
 // Simple color conversion function
 void cvtColor(const SimpleImage& src, SimpleImage& dst, ColorConversion conversion);
 
+// Convert count pixels of a single row. src and dst may be the same buffer
+// unless the conversion adds channels.
+void cvtColorRow(const uint8_t* src, uint8_t* dst, int count, ColorConversion conversion);
+
+// Premultiplied RGBA composited onto an opaque background color (R, G, B),
+// giving RGB; transparent pixels become the background. compositeRow may
+// write over its source row.
+void composite(const SimpleImage& src, SimpleImage& dst, const uint8_t background[3]);
+void compositeRow(const uint8_t* src, uint8_t* dst, int count, const uint8_t background[3]);
+
+// No pixel of a 4-channel image has alpha below 255 (true for other channel counts)
+bool isOpaque(const SimpleImage& image);
+
+// Channel counts of the source and destination of a conversion
+int srcChannels(ColorConversion conversion);
+int dstChannels(ColorConversion conversion);
+
 // Simple rotation function
 void rotate(const SimpleImage& src, SimpleImage& dst, RotationType rotation);
 
+// EXIF orientations (1-8) 5-8 swap width and height; other values are treated as 1
+bool isTransposed(int orientation);
+
+// Size of a width x height image once the EXIF orientation is applied
+SimpleSize orientedSize(int width, int height, int orientation);
+
+// Stores consecutive rows [first_row, ...) of a width x height image into dst
+// at an EXIF orientation; dst must already have the oriented size. Rows are
+// written into row() and handed over with commit(). Unrotated orientations
+// write straight into dst; transposing ones collect a block of rows and store
+// it a few pixels per destination row at a time instead of one pixel per row.
+// Writers over disjoint row ranges may share dst across threads.
+class OrientedRowWriter {
+public:
+    OrientedRowWriter(SimpleImage& dst, int width, int height, int orientation, int first_row = 0);
+    ~OrientedRowWriter() { flush(); }
+
+    // Buffer for the next row (width * channels bytes)
+    uint8_t* row();
+    void commit();
+
+    // Store buffered rows; called by commit() and the destructor as needed
+    void flush();
+
+private:
+    SimpleImage& m_dst;
+    int m_width;
+    int m_height;
+    int m_channels;
+    int m_orientation;
+    int m_y;
+    int m_block_rows = 0;
+    std::vector<uint8_t> m_block;
+};
+
+// Apply an EXIF orientation in a single pass (orientation 1 copies)
+void orient(const SimpleImage& src, SimpleImage& dst, int orientation);
+
 } // namespace simple_imgproc
 
 #endif // SIMPLE_IMGPROC_H
\ No newline at end of file
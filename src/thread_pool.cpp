@@ -0,0 +1,178 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+#if HAVE_THREADS
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+namespace thread_pool {
+
+// Below this many operations per band the hand-off costs more than it saves
+constexpr int64_t min_band_cost = 1 << 18;
+
+#if HAVE_THREADS
+namespace {
+
+// Persistent workers that share the bands of one job at a time with the caller
+class Pool {
+public:
+    Pool() {
+        unsigned hardware = std::thread::hardware_concurrency();
+        m_count = std::clamp(hardware > 0 ? static_cast<int>(hardware) : 1, 1, IMAGE_MAX_THREADS);
+    }
+
+    ~Pool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    int count() const { return m_count; }
+
+    void setCount(int count) {
+        std::lock_guard<std::mutex> submit(m_submit);
+        m_count = std::clamp(count, 1, IMAGE_MAX_THREADS);
+    }
+
+    void run(int32_t count, int32_t bands, const std::function<void(int32_t, int32_t)>& fn) {
+        std::unique_lock<std::mutex> submit(m_submit, std::try_to_lock);
+        bands = std::min(bands, m_count.load());
+        if (!submit.owns_lock() || bands <= 1) {
+            fn(0, count);
+            return;
+        }
+
+        // Workers are started on first use and kept for the process lifetime
+        while (static_cast<int32_t>(m_threads.size()) < bands - 1) {
+            m_threads.emplace_back([this] { workerLoop(); });
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = &fn;
+            m_count_items = count;
+            m_bands = bands;
+            m_next_band = 0;
+            m_pending = bands;
+            ++m_generation;
+        }
+        m_wake.notify_all();
+
+        runBands();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_pending == 0; });
+        m_job = nullptr;
+    }
+
+private:
+    // Take bands of the current job until none are left
+    void runBands() {
+        for (;;) {
+            int32_t begin;
+            int32_t end;
+            const std::function<void(int32_t, int32_t)>* job;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_job || m_next_band >= m_bands) {
+                    return;
+                }
+                const int32_t band = m_next_band++;
+                begin = static_cast<int32_t>(static_cast<int64_t>(m_count_items) * band / m_bands);
+                end = static_cast<int32_t>(static_cast<int64_t>(m_count_items) * (band + 1) / m_bands);
+                job = m_job;
+            }
+
+            (*job)(begin, end);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0) {
+                m_done.notify_one();
+            }
+        }
+    }
+
+    void workerLoop() {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop) {
+                    return;
+                }
+                seen = m_generation;
+            }
+            runBands();
+        }
+    }
+
+    std::mutex m_submit;   // Held by the caller for the duration of a job
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::vector<std::thread> m_threads;
+    std::atomic<int> m_count{1};
+
+    const std::function<void(int32_t, int32_t)>* m_job = nullptr;
+    int32_t m_count_items = 0;
+    int32_t m_bands = 0;
+    int32_t m_next_band = 0;
+    int32_t m_pending = 0;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+};
+
+Pool& pool() {
+    static Pool instance;
+    return instance;
+}
+
+} // namespace
+
+int threadCount() {
+    return pool().count();
+}
+
+void setThreadCount(int count) {
+    pool().setCount(count);
+}
+
+void parallelFor(int32_t count, int64_t cost_per_item,
+                 const std::function<void(int32_t begin, int32_t end)>& fn) {
+    if (count <= 0) {
+        return;
+    }
+    const int64_t total = static_cast<int64_t>(count) * std::max<int64_t>(cost_per_item, 1);
+    const auto bands = static_cast<int32_t>(std::min<int64_t>(count, total / min_band_cost));
+    pool().run(count, bands, fn);
+}
+
+#else
+
+int threadCount() {
+    return 1;
+}
+
+void setThreadCount(int) {
+}
+
+void parallelFor(int32_t count, int64_t,
+                 const std::function<void(int32_t begin, int32_t end)>& fn) {
+    if (count > 0) {
+        fn(0, count);
+    }
+}
+
+#endif
+
+} // namespace thread_pool
@@ -0,0 +1,39 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstdint>
+#include <functional>
+
+// Threads are available natively and in Emscripten builds with -pthread
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+    #define HAVE_THREADS 1
+#else
+    #define HAVE_THREADS 0
+#endif
+
+// Upper bound on threads including the caller. The -pthread wasm build
+// preallocates IMAGE_MAX_THREADS - 1 web workers (PTHREAD_POOL_SIZE), since
+// a blocked caller cannot wait for a worker to be spawned on demand.
+#ifndef IMAGE_MAX_THREADS
+#define IMAGE_MAX_THREADS 4
+#endif
+
+namespace thread_pool {
+
+// Threads used by parallelFor, including the caller (1 runs everything inline).
+// Defaults to the hardware concurrency capped at IMAGE_MAX_THREADS.
+int threadCount();
+
+// Clamped to [1, IMAGE_MAX_THREADS]; builds without threads always use 1
+void setThreadCount(int count);
+
+// Split [0, count) into contiguous bands and run fn(begin, end) for each,
+// one band per thread; returns when every band is done. cost_per_item is a
+// rough operation count per item so that small jobs stay on the caller.
+// Nested or concurrent calls run inline.
+void parallelFor(int32_t count, int64_t cost_per_item,
+                 const std::function<void(int32_t begin, int32_t end)>& fn);
+
+} // namespace thread_pool
+
+#endif // THREAD_POOL_H
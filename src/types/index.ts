@@ -4,6 +4,34 @@ export type OptimizeResult = {
   originalHeight: number;
   width: number;
   height: number;
+  quality?: number; // Encoder quality of the output (chosen by the search when maxBytes is set; absent for passthrough)
+};
+
+export type ResizeFilter =
+  | "nearest"
+  | "box"
+  | "bilinear"
+  | "bicubic"
+  | "lanczos";
+
+export type EncoderPreset = "default" | "fast" | "max";
+
+export type EncoderOptions = {
+  preset?: EncoderPreset; // Base settings, the fields below override it (optional, default "default")
+  // WebP
+  method?: number; // 0 (fastest) - 6 (smallest output), default 4
+  pass?: number; // Entropy analysis passes (1-10), default 1
+  segments?: number; // Segments (1-4), default 4
+  threadLevel?: number; // Non-zero: multi-threaded encode where libwebp supports it, default 0
+  sharpYuv?: boolean; // Sharper, slower RGB -> YUV conversion, default false
+  nearLossless?: number; // Lossless preprocessing (0 = strongest, 100 = off), default 100
+  losslessLevel?: number; // Lossless effort 0-9 (-1 = method at quality 70), default -1
+  // JPEG
+  progressive?: boolean; // default false
+  optimizeCoding?: boolean; // Optimized Huffman tables, default false
+  subsampling?: "4:2:0" | "4:2:2" | "4:4:4"; // Chroma subsampling, default 4:2:0
+  restartInterval?: number; // MCUs between restart markers (0 = none), default 0
+  dctMethod?: "islow" | "ifast" | "float"; // default islow
 };
 
 export type OptimizeParams = {
@@ -12,6 +40,53 @@ export type OptimizeParams = {
   height?: number; // The desired output height (optional)
   quality?: number; // The desired output quality (0-100, optional)
   format?: "webp" | "jpeg" | "none"; // The desired output format - WebP only (optional)
+  filter?: ResizeFilter; // Resampling filter (optional, default lanczos)
+  reducingGap?: number; // Box-reduce large downscales to this many times the output before filtering (>= 1, optional, default off)
+  passthroughBytes?: number; // Return inputs up to this size as is when they already have the format, fit the bounds and need no rotation (optional, default 0 = off)
+  maxBytes?: number; // Byte budget: search the highest quality (up to `quality`) whose output fits (optional, default 0 = off)
+  encoder?: EncoderOptions; // Encoder speed / effort settings (optional)
+  planarYuv?: boolean; // Keep YCbCr JPEG input in Y / Cb / Cr planes through resize and encode (optional, default false)
+  background?: string; // "#rgb" / "#rrggbb" behind transparent pixels for jpeg output (optional, default: alpha dropped)
+  losslessOrientation?: boolean; // JPEG -> jpeg needing only its EXIF orientation: rotate the DCT blocks instead of re-encoding (optional, default false)
+  keepMetadata?: boolean; // Keep APPn / COM markers (EXIF, XMP, comments) in lossless orientation output; otherwise only an ICC profile (optional, default false)
+  useThumbnail?: boolean; // Resize the embedded EXIF thumbnail of a JPEG instead of the full image when the output fits inside it (optional, default false)
+};
+
+export type OptimizeTarget = {
+  width?: number; // The desired output width (optional)
+  height?: number; // The desired output height (optional)
+  quality?: number; // The desired output quality (0-100, optional)
+  format?: "webp" | "jpeg" | "none"; // The desired output format (optional)
+  filter?: ResizeFilter; // Resampling filter (optional, default lanczos)
+  reducingGap?: number; // Box-reduce large downscales to this many times the output before filtering (>= 1, optional, default off)
+  passthroughBytes?: number; // Return inputs up to this size as is when they already have the format, fit the bounds and need no rotation (optional, default 0 = off)
+  maxBytes?: number; // Byte budget: search the highest quality (up to `quality`) whose output fits (optional, default 0 = off)
+  encoder?: EncoderOptions; // Encoder speed / effort settings (optional)
+  background?: string; // "#rgb" / "#rrggbb" behind transparent pixels for jpeg output (optional, default: alpha dropped)
+  losslessOrientation?: boolean; // JPEG -> jpeg needing only its EXIF orientation: rotate the DCT blocks instead of re-encoding (optional, default false)
+  keepMetadata?: boolean; // Keep APPn / COM markers (EXIF, XMP, comments) in lossless orientation output; otherwise only an ICC profile (optional, default false)
+  useThumbnail?: boolean; // Resize the embedded EXIF thumbnail of a JPEG instead of the full image when the output fits inside it (optional, default false)
+};
+
+export type OptimizeManyParams = {
+  image: BufferSource | string; // The input image data (decoded once)
+  targets: OptimizeTarget[]; // Outputs to produce, results keep this order
+  cascadeRatio?: number; // Resize from an earlier output at least this many times larger (0 = always from the source, default 2)
+};
+
+export type ProbeParams = {
+  image: BufferSource | string; // The input image data (only the headers are read)
+};
+
+export type ProbeResult = {
+  format: "jpeg" | "png" | "webp";
+  width: number; // Stored width (orientation 5-8 swaps width and height on display)
+  height: number; // Stored height
+  channels: number; // Encoded channels (gray 1, gray+alpha 2, color 3, with alpha / CMYK 4)
+  bitDepth: number; // Bits per sample as stored
+  hasAlpha: boolean;
+  progressive: boolean; // Progressive JPEG or interlaced PNG
+  orientation: number; // EXIF orientation (1-8)
 };
 
 export type WasmConfig = {
@@ -1,9 +1,36 @@
 import LibImage, { type ModuleType } from "../cjs/libImage.js";
 import WASM from "../esm/libImage.wasm?url";
-import { _optimizeImage, _optimizeImageExt } from "../lib/optimizeImage.js";
+import {
+  _optimizeImage,
+  _optimizeImageExt,
+  _optimizeImageMany,
+  _probeImage,
+} from "../lib/optimizeImage.js";
 import { getWasmConfig, setWasmUrl, setWasmBinary, resetWasmConfig } from "../types/index.js";
-import type { OptimizeParams, OptimizeResult, WasmConfig } from "../types/index.js";
-export type { OptimizeParams, OptimizeResult, WasmConfig };
+import type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+  WasmConfig,
+} from "../types/index.js";
+export type {
+  EncoderOptions,
+  EncoderPreset,
+  OptimizeManyParams,
+  OptimizeParams,
+  OptimizeResult,
+  OptimizeTarget,
+  ProbeParams,
+  ProbeResult,
+  ResizeFilter,
+  WasmConfig,
+};
 export { setWasmUrl, setWasmBinary, resetWasmConfig };
 
 let libImage: Promise<ModuleType>;
@@ -36,3 +63,9 @@ export const optimizeImage = (params: OptimizeParams) =>
 
 export const optimizeImageExt = (params: OptimizeParams) =>
   _optimizeImageExt({ ...params, libImage: getLibImage() });
+
+export const optimizeImageMany = (params: OptimizeManyParams) =>
+  _optimizeImageMany({ ...params, libImage: getLibImage() });
+
+export const probeImage = (params: ProbeParams) =>
+  _probeImage({ ...params, libImage: getLibImage() });